@@ -0,0 +1,167 @@
+#!/bin/bash
+
+# Pruebas de rendimiento de scalaf con terrenos sintéticos
+# (build/terrenoSintetico).  Para cada terreno, tamaño, número de procesos
+# y de hilos corre la simulación completa con -i y saca del reporte el
+# tiempo de la simulación y de cada núcleo (reología, salidas y flujos,
+# consolidación y la escritura de instantáneas) en Mceldas/s.  Las
+# instantáneas se escriben binarias y sin hilo aparte (-m 0), así su fase
+# mide la escritura completa.
+#
+# Los resultados quedan en build/bench/resultados.csv y se comparan con
+# bench/referencia.csv: una medida más lenta que la referencia por más de
+# TOLERANCIA por ciento es una regresión y el script termina con error.
+# La referencia depende de la máquina, se crea con
+#
+#   make bench-referencia
+#
+# Las variables de abajo se pueden cambiar desde el ambiente, por ejemplo
+#
+#   TAMANOS="512 2048 16384" PROCESOS="1 2 4 8" make bench
+#
+# Un mapa de 16384 x 16384 necesita unos 18 GB entre todos los procesos.
+
+cd "$(dirname "$0")/.." || exit 1
+RAIZ=$(pwd)
+
+# lados de los terrenos cuadrados
+TAMANOS=${TAMANOS:-"512 1024"}
+TERRENOS=${TERRENOS:-"plano inclinado cono fractal"}
+CRATERES=${CRATERES:-4}
+PASOS=${PASOS:-20}
+# procesos MPI y hilos de OpenMP (los hilos solo con make OPENMP=1)
+PROCESOS=${PROCESOS:-"1 2"}
+HILOS=${HILOS:-1}
+NUCLEOS=${NUCLEOS:-auto}
+TOLERANCIA=${TOLERANCIA:-10}
+MPIRUN=${MPIRUN:-mpirun}
+
+TRABAJO=$RAIZ/build/bench
+RESULTADOS=$TRABAJO/resultados.csv
+REFERENCIA=$RAIZ/bench/referencia.csv
+
+mkdir -p "$TRABAJO"
+echo "terreno,lado,procesos,hilos,medida,segundos,mceldas_s" > "$RESULTADOS"
+
+for lado in $TAMANOS; do
+	for terreno in $TERRENOS; do
+		ARCH_TERRENO=$TRABAJO/${terreno}_${lado}.bin
+		ARCH_CRATER=$TRABAJO/${terreno}_${lado}_crateres
+		if [ ! -f "$ARCH_TERRENO" ] || [ ! -f "$ARCH_CRATER" ]; then
+			"$RAIZ"/build/terrenoSintetico -t $terreno -n $lado \
+				-p $CRATERES -s "$ARCH_CRATER" -o "$ARCH_TERRENO" || exit 1
+		fi
+		for procesos in $PROCESOS; do
+			for hilos in $HILOS; do
+				printf "%-9s %6d  %2d procesos  %2d hilos\n" $terreno $lado \
+					$procesos $hilos
+				CORRIDA=$TRABAJO/corrida
+				rm -rf "$CORRIDA"
+				mkdir -p "$CORRIDA"
+				(cd "$CORRIDA" && $MPIRUN -np $procesos "$RAIZ"/build/scalaf \
+					-t 1500 -v 100 -w 1 -s "$ARCH_CRATER" -a "$ARCH_TERRENO" \
+					-r $lado -c $lado -p $CRATERES -e bench -n $PASOS \
+					-f binario -m 0 -k $NUCLEOS -h $hilos -i medicion.csv \
+					> salida.txt 2>&1)
+				if [ ! -f "$CORRIDA/medicion.csv" ]; then
+					echo "ERROR: la corrida falló, ver $CORRIDA/salida.txt"
+					exit 1
+				fi
+				# columnas del reporte: rank, paso, 9 fases, total, ...; el
+				# tiempo de cada medida es el del proceso más lento
+				awk -F, -v terreno=$terreno -v lado=$lado -v procesos=$procesos \
+					-v hilos=$hilos -v pasos=$PASOS '
+				NR == 1 { next }
+				{
+					for (f = 3; f <= 11; f++) {
+						fase[$1, f] += $f
+					}
+					if ($12 > paso[$2]) {
+						paso[$2] = $12
+					}
+					ranks[$1] = 1
+				}
+				function lento(f1, f2,   r, t, m) {
+					m = 0
+					for (r in ranks) {
+						t = fase[r, f1] + (f2 ? fase[r, f2] : 0)
+						m = (t > m) ? t : m
+					}
+					return m
+				}
+				function medida(nombre, t, celdas) {
+					printf "%s,%d,%d,%d,%s,%.6f,%.2f\n", terreno, lado, procesos,
+						hilos, nombre, t, (t > 0) ? celdas / t / 1e6 : 0
+				}
+				END {
+					celdas = lado * lado * pasos
+					for (p in paso) {
+						total += paso[p]
+					}
+					medida("completo", total, celdas)
+					medida("reologia", lento(3), celdas)
+					# las salidas se calculan junto con los flujos
+					medida("flujos", lento(4), celdas)
+					medida("consolidacion", lento(5), celdas)
+					# una instantánea cada 5 pasos, reunida y escrita
+					medida("instantaneas", lento(8, 9),
+						lado * lado * int((pasos + 4) / 5))
+				}' "$CORRIDA/medicion.csv" >> "$RESULTADOS"
+			done
+		done
+	done
+done
+rm -rf "$TRABAJO/corrida"
+
+# escalamiento de la simulación completa respecto a la primera combinación
+# de procesos e hilos
+echo
+echo "Escalamiento (simulación completa):"
+awk -F, 'NR > 1 && $5 == "completo" {
+	clave = $1 " " $2
+	if (!(clave in base)) {
+		base[clave] = $7
+	}
+	printf "  %-9s %6d  %2d procesos  %2d hilos  %10.2f Mceldas/s  x%.2f\n",
+		$1, $2, $3, $4, $7, (base[clave] > 0) ? $7 / base[clave] : 0
+}' "$RESULTADOS"
+
+if [ "$1" = "--referencia" ]; then
+	cp "$RESULTADOS" "$REFERENCIA"
+	echo
+	echo "Referencia guardada en $REFERENCIA"
+	exit 0
+fi
+if [ ! -f "$REFERENCIA" ]; then
+	echo
+	echo "No hay referencia, se crea con make bench-referencia"
+	exit 0
+fi
+
+# comparación con la referencia; las medidas de menos de 10 ms son ruido
+echo
+echo "Comparación con $REFERENCIA (tolerancia $TOLERANCIA%):"
+awk -F, -v tolerancia=$TOLERANCIA '
+FNR == 1 { next }
+NR == FNR {
+	referencia[$1, $2, $3, $4, $5] = $7
+	segundos[$1, $2, $3, $4, $5] = $6
+	next
+}
+{
+	clave = $1 SUBSEP $2 SUBSEP $3 SUBSEP $4 SUBSEP $5
+	if (!(clave in referencia) || segundos[clave] < 0.01) {
+		next
+	}
+	cambio = 100 * ($7 - referencia[clave]) / referencia[clave]
+	estado = (cambio < -tolerancia) ? "REGRESION" : \
+		(cambio > tolerancia) ? "mejora" : "igual"
+	regresiones += (estado == "REGRESION")
+	printf "  %-9s %6d  %2d procesos  %2d hilos  %-13s %10.2f -> %10.2f " \
+		"Mceldas/s  %+6.1f%%  %s\n", $1, $2, $3, $4, $5, referencia[clave], $7,
+		cambio, estado
+}
+END {
+	printf "\n%d regresiones\n", regresiones
+	exit (regresiones > 0)
+}' "$REFERENCIA" "$RESULTADOS"
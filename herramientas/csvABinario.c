@@ -0,0 +1,71 @@
+/*
+Convierte un mapa de alturas CSV al formato binario de scalaf (ver
+src/terreno.c), que se carga con mmap sin interpretar texto.
+
+Uso: csvABinario -a alturas.csv -r filas -c columnas [-w ancho] [-f]
+                 -o alturas.bin
+
+Con -f las altitudes se guardan en float en lugar de double, lo que reduce
+el archivo a la mitad.
+*/
+
+#include "../src/scalaf.h"
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char *argv[]) {
+  char *entrada = NULL, *salida = NULL;
+  int filas = 0, columnas = 0, bytesValor = sizeof(double);
+  double ancho = 1.0;
+  int option, ok;
+  mapGrid mapa;
+
+  while ((option = getopt(argc, argv, "a:r:c:w:fo:")) != -1) {
+    switch (option) {
+    case 'a':
+      // Archivo de altitudes CSV
+      entrada = optarg;
+      break;
+    case 'r':
+      // Número de filas
+      filas = atol(optarg);
+      break;
+    case 'c':
+      // Número de columnas
+      columnas = atol(optarg);
+      break;
+    case 'w':
+      // Ancho de las celdas cuadradas
+      ancho = atof(optarg);
+      break;
+    case 'f':
+      // Altitudes en float
+      bytesValor = sizeof(float);
+      break;
+    case 'o':
+      // Archivo binario de salida
+      salida = optarg;
+      break;
+    }
+  }
+  if (entrada == NULL || salida == NULL || filas <= 0 || columnas <= 0) {
+    fprintf(stderr, "Uso: %s -a alturas.csv -r filas -c columnas [-w ancho] "
+                    "[-f] -o alturas.bin\n",
+            argv[0]);
+    return 1;
+  }
+  if (!crearMalla(&mapa, filas + 2, columnas + 2)) {
+    fprintf(stderr, "No hay memoria para un mapa de %d x %d.\n", filas,
+            columnas);
+    return 1;
+  }
+  ok = readTerrainFile(entrada, filas, columnas, &mapa) &&
+       escribirTerrenoBinario(salida, &mapa, ancho, bytesValor);
+  printf("\n");
+  if (!ok) {
+    fprintf(stderr, "No se pudo escribir %s.\n", salida);
+  }
+  liberarMalla(&mapa);
+  return !ok;
+}
@@ -0,0 +1,87 @@
+/*
+Convierte instantáneas binarias (.scf, ver src/instantaneas_bin.c) a los
+archivos de texto de gnuplot que escribe scalaf con el formato gnuplot, y
+genera sus imágenes.
+
+Uso: instantaneasAGnuplot -a etiqueta_terreno.bin etiqueta_0.scf
+                          etiqueta_5.scf ...
+
+Las instantáneas dispersas necesitan la anterior, así que los archivos se
+dan en el orden de los pasos.  La instantánea etiqueta_N.scf produce
+etiqueta_N y etiqueta_N_enca, igual que la simulación.
+*/
+
+#include "../src/scalaf.h"
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char *argv[]) {
+  char *terreno = NULL;
+  char base[1024], sufijo[32];
+  encabezadoTerreno E;
+  estadoInstantanea S = {0};
+  mapGrid mapa;
+  int option, a, i, j, errores = 0;
+
+  while ((option = getopt(argc, argv, "a:")) != -1) {
+    switch (option) {
+    case 'a':
+      // Terreno binario con la altitud
+      terreno = optarg;
+      break;
+    }
+  }
+  if (terreno == NULL || optind >= argc) {
+    fprintf(stderr,
+            "Uso: %s -a etiqueta_terreno.bin etiqueta_0.scf [...]\n",
+            argv[0]);
+    return 1;
+  }
+  if (!leerEncabezadoTerreno(terreno, &E) ||
+      !crearMalla(&mapa, E.filas + 2, E.columnas + 2)) {
+    fprintf(stderr, "No se pudo leer el terreno %s.\n", terreno);
+    return 1;
+  }
+  if (!leerTerrenoBinario(terreno, E.filas, E.columnas, &mapa)) {
+    liberarMalla(&mapa);
+    return 1;
+  }
+  printf("\n");
+  for (a = optind; a < argc; a++) {
+    size_t largo = strlen(argv[a]);
+    if (!leerInstantaneaBinaria(argv[a], &S) || S.filas != E.filas ||
+        S.columnas != E.columnas) {
+      fprintf(stderr, "No se pudo leer la instantánea %s.\n", argv[a]);
+      errores++;
+      // las dispersas que siguen dependen de esta
+      S.secuencia = -1;
+      continue;
+    }
+    for (i = 0; i < S.filas; i++) {
+      for (j = 0; j < S.columnas; j++) {
+        size_t k = (size_t)(i + 1) * mapa.columnas + j + 1;
+        mapa.thickness[k] = S.thickness[(size_t)i * S.columnas + j];
+        mapa.temperature[k] = S.temperature[(size_t)i * S.columnas + j];
+      }
+    }
+    // nombre base: el del archivo sin el paso y sin .scf
+    snprintf(sufijo, sizeof(sufijo), "%d.scf", S.secuencia);
+    if (largo >= sizeof(base) || largo < strlen(sufijo) ||
+        strcmp(argv[a] + largo - strlen(sufijo), sufijo) != 0) {
+      fprintf(stderr, "%s no se llama como la instantánea del paso %d.\n",
+              argv[a], S.secuencia);
+      errores++;
+      continue;
+    }
+    strcpy(base, argv[a]);
+    base[largo - strlen(sufijo)] = '\0';
+    prepararVisualizacionGNUPlot_2(S.secuencia, base, mapa.filas,
+                                   mapa.columnas, &mapa, 3, E.anchoCelda, 0,
+                                   0);
+  }
+  liberarEstadoInstantanea(&S);
+  liberarMalla(&mapa);
+  return errores > 0;
+}
@@ -0,0 +1,183 @@
+/*
+Genera terrenos sintéticos en el formato binario de scalaf (ver
+src/terreno.c) para medir el rendimiento sin depender de un DEM real.
+
+Uso: terrenoSintetico -t plano|inclinado|cono|fractal -n lado [-w ancho]
+                      [-p crateres] [-s crateres.txt] [-x semilla]
+                      -o terreno.bin
+
+Los terrenos son cuadrados de lado x lado celdas:
+
+  plano      altitud constante, la lava se extiende en todas direcciones
+  inclinado  un plano con 10% de pendiente hacia la última fila
+  cono       un volcán con 30% de pendiente desde el centro
+  fractal    ruido de valores con 6 octavas sobre una pendiente suave
+
+Las filas se calculan y se escriben una por una, así un terreno de 16384 x
+16384 no necesita la malla completa en memoria.  Con -s se escribe también
+el archivo de cráteres (fila,columna por línea) con -p cráteres repartidos
+en una cuadrícula alrededor del centro; con -x cambia el ruido del terreno
+fractal.
+*/
+
+#include "../src/scalaf.h"
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { plano, inclinado, cono, fractal };
+
+#define altitud_base 1000.0
+#define octavas 6
+
+// Número pseudoaleatorio en [0, 1) del punto (x, y) de la octava o.
+static double ruido(unsigned int x, unsigned int y, unsigned int o,
+                    unsigned int semilla) {
+  unsigned int h = x * 0x8da6b343u ^ y * 0xd8163841u ^ o * 0xcb1ab31fu ^
+                   semilla * 0x165667b1u;
+  h ^= h >> 15;
+  h *= 0x2c1b3c6du;
+  h ^= h >> 12;
+  h *= 0x297a2d39u;
+  h ^= h >> 15;
+  return (h >> 8) / 16777216.0;
+}
+
+// Ruido de valores interpolado en (x, y), con puntos cada periodo celdas.
+static double ruidoSuave(double x, double y, double periodo, int o,
+                         unsigned int semilla) {
+  double u = x / periodo, v = y / periodo;
+  unsigned int i = (unsigned int)u, j = (unsigned int)v;
+  double fu = u - i, fv = v - j;
+  double a, b;
+  fu = fu * fu * (3 - 2 * fu);
+  fv = fv * fv * (3 - 2 * fv);
+  a = ruido(i, j, o, semilla) +
+      fv * (ruido(i, j + 1, o, semilla) - ruido(i, j, o, semilla));
+  b = ruido(i + 1, j, o, semilla) +
+      fv * (ruido(i + 1, j + 1, o, semilla) - ruido(i + 1, j, o, semilla));
+  return a + fu * (b - a);
+}
+
+// Altitud de la celda (i, j) del terreno de lado x lado.
+static double altitudSintetica(int tipo, int i, int j, int lado, double ancho,
+                               unsigned int semilla) {
+  double centro = (lado - 1) / 2.0, d, z, periodo, amplitud;
+  int o;
+  switch (tipo) {
+  case inclinado:
+    return altitud_base + 0.1 * (lado - 1 - i) * ancho;
+  case cono:
+    d = sqrt((i - centro) * (i - centro) + (j - centro) * (j - centro));
+    return altitud_base + 0.3 * (centro - d) * ancho;
+  case fractal:
+    // pendiente suave hacia la última fila para que la lava avance
+    z = altitud_base + 0.02 * (lado - 1 - i) * ancho;
+    periodo = lado / 4.0;
+    amplitud = 0.05 * periodo * ancho;
+    for (o = 0; o < octavas && periodo >= 1; o++) {
+      z += amplitud * ruidoSuave(i, j, periodo, o, semilla);
+      periodo /= 2;
+      amplitud /= 2;
+    }
+    return z;
+  default:
+    return altitud_base;
+  }
+}
+
+// Escribe los cráteres en una cuadrícula de lado ceil(sqrt(numCrateres))
+// sobre la mitad central del mapa.
+static int escribirCrateres(const char *path, int numCrateres, int lado) {
+  FILE *archivo = fopen(path, "w");
+  int k, m = (int)ceil(sqrt(numCrateres)), ok;
+  if (archivo == NULL) {
+    return 0;
+  }
+  ok = 1;
+  for (k = 0; k < numCrateres && ok; k++) {
+    int fila = lado / 4 + (2 * (k / m) + 1) * (lado / 2) / (2 * m);
+    int columna = lado / 4 + (2 * (k % m) + 1) * (lado / 2) / (2 * m);
+    ok = fprintf(archivo, "%d,%d\n", fila, columna) > 0;
+  }
+  return (fclose(archivo) == 0) && ok;
+}
+
+int main(int argc, char *argv[]) {
+  const char *nombres[] = {"plano", "inclinado", "cono", "fractal"};
+  char *salida = NULL, *crateres = NULL;
+  int tipo = -1, lado = 0, numCrateres = 1, option, i, j, ok;
+  unsigned int semilla = 1;
+  double ancho = 1.0;
+  float *fila;
+  FILE *archivo;
+
+  while ((option = getopt(argc, argv, "t:n:w:p:s:x:o:")) != -1) {
+    switch (option) {
+    case 't':
+      // Tipo de terreno
+      for (i = 0; i < 4; i++) {
+        if (strcmp(optarg, nombres[i]) == 0) {
+          tipo = i;
+        }
+      }
+      break;
+    case 'n':
+      // Filas y columnas del terreno
+      lado = atol(optarg);
+      break;
+    case 'w':
+      // Ancho de las celdas cuadradas
+      ancho = atof(optarg);
+      break;
+    case 'p':
+      // Número de cráteres
+      numCrateres = atol(optarg);
+      break;
+    case 's':
+      // Archivo de ubicación de cráteres
+      crateres = optarg;
+      break;
+    case 'x':
+      // Semilla del ruido del terreno fractal
+      semilla = atol(optarg);
+      break;
+    case 'o':
+      // Archivo binario de salida
+      salida = optarg;
+      break;
+    }
+  }
+  if (tipo < 0 || salida == NULL || lado <= 0 || numCrateres <= 0) {
+    fprintf(stderr, "Uso: %s -t plano|inclinado|cono|fractal -n lado "
+                    "[-w ancho] [-p crateres] [-s crateres.txt] "
+                    "[-x semilla] -o terreno.bin\n",
+            argv[0]);
+    return 1;
+  }
+  fila = (float *)malloc(lado * sizeof(float));
+  archivo = fopen(salida, "wb");
+  ok = fila != NULL && archivo != NULL &&
+       escribirEncabezadoTerreno(archivo, lado, lado, ancho, sizeof(float));
+  for (i = 0; i < lado && ok; i++) {
+    for (j = 0; j < lado; j++) {
+      fila[j] = (float)altitudSintetica(tipo, i, j, lado, ancho, semilla);
+    }
+    ok = fwrite(fila, sizeof(float), lado, archivo) == (size_t)lado;
+  }
+  if (archivo != NULL) {
+    ok = (fclose(archivo) == 0) && ok;
+  }
+  free(fila);
+  if (!ok) {
+    fprintf(stderr, "No se pudo escribir %s.\n", salida);
+    return 1;
+  }
+  if (crateres != NULL && !escribirCrateres(crateres, numCrateres, lado)) {
+    fprintf(stderr, "No se pudo escribir %s.\n", crateres);
+    return 1;
+  }
+  return 0;
+}
@@ -12,11 +12,53 @@ time_steps=10
 # Config Parameters
 ARCH_EXEC=build/scalaf
 ARCH_OUTPUT=output/
+# CSV o terreno binario creado con build/csvABinario
 ARCH_ALTITUD=altitudesMil.csv
 ARCH_CRATER=crater_location
 BASENAME=${map_rows}x${map_columns}_EXP
 number_of_repetitions=1
 
+# Procesos MPI, cada uno calcula una franja de filas del mapa
+PROCESOS=1
+
+# Balance de las franjas: con pasos entre revisiones se mueven las fronteras
+# de las franjas hacia donde está la lava (ver src/balance.c)
+PASOS_BALANCE=
+BALANCE=${PASOS_BALANCE:+-b $PASOS_BALANCE}
+
+# Formato de las instantáneas: apng o y4m escriben una sola animación
+# ${ITERATION_NAME}_animacion.png (o .y4m); gnuplot, binario o png escriben
+# un archivo por instantánea, que se comprimen al final
+FORMATO=apng
+# Con COLECTIVAS=1 las instantáneas son binarias y las escriben todos los
+# procesos en un solo archivo por paso con MPI-IO (ver
+# src/instantaneas_mpi.c); FORMATO debe ser binario para comprimirlas
+COLECTIVAS=
+MPIIO=${COLECTIVAS:+-o}
+
+# Conjunto de escenarios: con un archivo de escenarios (ver src/conjunto.c)
+# todos se simulan en una sola ejecución sobre el mismo terreno, repartidos
+# entre los procesos; -t, -v, -s y -p no se usan
+ARCH_ESCENARIOS=
+CONJUNTO=${ARCH_ESCENARIOS:+-l $ARCH_ESCENARIOS}
+
+# Paso de tiempo adaptativo: con segundos por simular se avanza hasta ese
+# tiempo con dt variable (ver src/paso.c) y time_steps es el máximo de pasos
+TIEMPO_SIMULADO=
+ADAPTATIVO=${TIEMPO_SIMULADO:+-T $TIEMPO_SIMULADO}
+
+# Mapas más grandes que la memoria: con un directorio las mallas se guardan
+# en archivos ahí y en RAM queda solo lo que rodea a la lava (ver
+# src/malla.c); conviene junto con COLECTIVAS=1
+DIRECTORIO_MALLAS=
+FUERA_DE_MEMORIA=${DIRECTORIO_MALLAS:+-x $DIRECTORIO_MALLAS}
+
+# Bloques temporales: con pasos, cada bloque de celdas avanza hasta esos
+# pasos seguidos mientras está en la caché (ver src/bloques.c); solo con
+# PROCESOS=1 y sin TIEMPO_SIMULADO
+PASOS_POR_BLOQUE=
+BLOQUES_TEMPORALES=${PASOS_POR_BLOQUE:+-u $PASOS_POR_BLOQUE}
+
 HILOS_BLOQUE=171
 BLOQUES=$(($map_rows/$HILOS_BLOQUE))
 
@@ -32,16 +74,21 @@ for i in `seq 0 $((${number_of_repetitions} -1))`;
 	printf "\nOUTPUT_FILE: $ARCH_SALIDA"
 	printf "\nERROR_FILE: $ARCH_ERROR"
 	
-	printf "\ntime ./$ARCH_EXEC -t $eruption_temperature -v $eruption_rate -w $cell_width -s $ARCH_CRATER -a $ARCH_ALTITUD -r $map_rows -c $map_columns -p $number_of_craters -e $ITERATION_NAME -n $time_steps > $ARCH_SALIDA 2 > $ARCH_ERROR"
-	time ./$ARCH_EXEC -t $eruption_temperature -v $eruption_rate -w $cell_width -s $ARCH_CRATER -a $ARCH_ALTITUD -r $map_rows -c $map_columns -p $number_of_craters -e $ITERATION_NAME -n $time_steps > $ARCH_SALIDA
+	printf "\ntime ./$ARCH_EXEC -t $eruption_temperature -v $eruption_rate -w $cell_width -s $ARCH_CRATER -a $ARCH_ALTITUD -r $map_rows -c $map_columns -p $number_of_craters -e $ITERATION_NAME -n $time_steps -f $FORMATO $CONJUNTO $ADAPTATIVO $BALANCE $MPIIO $FUERA_DE_MEMORIA $BLOQUES_TEMPORALES > $ARCH_SALIDA 2> $ARCH_ERROR"
+	time mpirun -np $PROCESOS ./$ARCH_EXEC -t $eruption_temperature -v $eruption_rate -w $cell_width -s $ARCH_CRATER -a $ARCH_ALTITUD -r $map_rows -c $map_columns -p $number_of_craters -e $ITERATION_NAME -n $time_steps -f $FORMATO $CONJUNTO $ADAPTATIVO $BALANCE $MPIIO $FUERA_DE_MEMORIA $BLOQUES_TEMPORALES > $ARCH_SALIDA 2> $ARCH_ERROR
 	
-	# Comprimir resultados y mover a directorio de salida
-	tar -zcvpf ${ITERATION_NAME}.tgz ${ITERATION_NAME}_*
 	mkdir -p ${ARCH_OUTPUT}
-    mv ${ITERATION_NAME}* ${ARCH_OUTPUT}
-	printf "\nArchivo copiado en ${ARCH_OUTPUT}"
-	rm ${ITERATION_NAME}_*
-	printf "\nArchivos limpiados"
+	if [ "$FORMATO" = apng ] || [ "$FORMATO" = y4m ]; then
+		# la animación ya es un solo archivo
+		mv ${ITERATION_NAME} ${ITERATION_NAME}_* ${ARCH_OUTPUT}
+	else
+		# Comprimir las instantáneas y mover a directorio de salida
+		tar -zcpf ${ITERATION_NAME}.tgz --remove-files \
+			--exclude=${ARCH_ERROR} ${ITERATION_NAME}_*
+		mv ${ITERATION_NAME} ${ITERATION_NAME}.tgz ${ARCH_ERROR} ${ARCH_OUTPUT}
+		printf "\nArchivos limpiados"
+	fi
+	printf "\nArchivos copiados en ${ARCH_OUTPUT}"
 	done
 
 printf "\nFin de las iteraciones"
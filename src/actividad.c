@@ -0,0 +1,207 @@
+/*
+Mapa de actividad de la franja: solo se calculan los tiles que tienen lava
+o están junto a un tile con lava, el resto del terreno seco se salta.
+
+Una celda seca (grosor <= 1e-8, a 273 K y sin cráter) cuyas vecinas también
+están secas no cambia en un paso: no cede volumen porque no supera el grosor
+crítico, no recibe porque ninguna vecina lo supera, y la consolidación le
+deja el mismo grosor y 273 K.  Tampoco importan su viscosidad, yield ni
+salidas, que solo se usan para el volumen que cede.  Por eso basta calcular
+las celdas a distancia 1 de una celda viva, y marcar activos los tiles vivos
+y sus 8 vecinos cubre esa distancia de sobra.
+
+En las celdas que se saltan, viscosity, yield y los flujos guardan el valor
+de su último paso activo.  Las salidas de las celdas secas junto a un tile
+activo se pueden recalcular (ver siguienteTramoVecino) y quedan en 0.
+*/
+
+#include "scalaf.h"
+#include <stdlib.h>
+
+// Revisa si la celda k tiene lava, un cráter o no está a la temperatura
+// del terreno seco.
+static inline int celdaViva(const mapGrid *A, int k) {
+  return A->isVent[k] || A->thickness[k] > 1e-8 || A->temperature[k] != 273.0;
+}
+
+// Primera y última (excluida) fila local que es interior de la matriz
+// agrandada.  Las filas de los bordes tienen temperatura 0 y no cuentan.
+static void filasInteriores(const franjaLocal *F, int *f0, int *f1) {
+  int primera = F->filaInicio - filas_halo; // fila global de la fila local 0
+  *f0 = (primera < 1) ? 1 - primera : 0;
+  *f1 = F->celdas.filas;
+  if (primera + *f1 > F->filas + 1) {
+    *f1 = F->filas + 1 - primera;
+  }
+}
+
+// Revisa las filas [f0, f1) y columnas interiores del tile (ti, tj).
+static int tileVivo(const franjaLocal *F, int ti, int tj, int f0, int f1) {
+  int i, j, C = F->columnas;
+  int i0 = ti * lado_tile, i1 = i0 + lado_tile;
+  int j0 = tj * lado_tile, j1 = j0 + lado_tile;
+  if (i0 < f0)
+    i0 = f0;
+  if (i1 > f1)
+    i1 = f1;
+  if (j0 < 1)
+    j0 = 1;
+  if (j1 > C - 1)
+    j1 = C - 1;
+  for (i = i0; i < i1; i++) {
+    for (j = j0; j < j1; j++) {
+      if (celdaViva(&F->celdas, i * C + j)) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+int crearActividad(franjaLocal *F) {
+  F->filasTiles = (F->celdas.filas + lado_tile - 1) / lado_tile;
+  F->columnasTiles = (F->columnas + lado_tile - 1) / lado_tile;
+  F->vivas = (unsigned char *)calloc(F->filasTiles * F->columnasTiles, 1);
+  F->activas = (unsigned char *)calloc(F->filasTiles * F->columnasTiles, 1);
+  if (!(F->vivas && F->activas)) {
+    liberarActividad(F);
+    return 0;
+  }
+  actualizarActividad(F, 1);
+  return 1;
+}
+
+void liberarActividad(franjaLocal *F) {
+  free(F->vivas);
+  free(F->activas);
+  F->vivas = NULL;
+  F->activas = NULL;
+}
+
+// Recalcula el mapa de actividad después de un paso.  Fuera de los tiles
+// activos nada cambió, así que solo se revisan esos tiles (o todos si
+// completo es 1).  Las filas fantasma sí cambian con cada intercambio y se
+// revisan siempre; como llegaron al inicio del paso tienen un paso de
+// retraso, que cubren los tiles vecinos.
+void actualizarActividad(franjaLocal *F, int completo) {
+  int ti, tj, f0, f1;
+  int T = F->filasTiles, K = F->columnasTiles;
+  int n = F->celdas.filas;
+  if (F->activas == NULL) {
+    return;
+  }
+  filasInteriores(F, &f0, &f1);
+#pragma omp parallel for private(tj) schedule(static)
+  for (ti = 0; ti < T; ti++) {
+    for (tj = 0; tj < K; tj++) {
+      unsigned char antes = F->vivas[ti * K + tj];
+      if (completo || F->activas[ti * K + tj]) {
+        F->vivas[ti * K + tj] = tileVivo(F, ti, tj, f0, f1);
+      } else if (ti * lado_tile < filas_halo ||
+                 (ti + 1) * lado_tile > n - filas_halo) {
+        // tile con filas fantasma que no estaba activo: sus filas propias
+        // siguen secas, solo pueden cambiar las fantasma
+        int g0 = (f0 > n - filas_halo) ? f0 : n - filas_halo;
+        F->vivas[ti * K + tj] =
+            tileVivo(F, ti, tj, f0, (filas_halo < f1) ? filas_halo : f1) ||
+            tileVivo(F, ti, tj, g0, f1);
+      }
+      if (F->vivas[ti * K + tj] && !antes) {
+        // la lava llegó al tile: con las mallas fuera de memoria se piden
+        // los tiles a los que puede llegar después
+        anticiparCeldas(&F->celdas, (ti - 2) * lado_tile,
+                        (ti + 3) * lado_tile, (tj - 2) * lado_tile,
+                        (tj + 3) * lado_tile);
+      }
+    }
+  }
+  // dilatar: un tile es activo si él o alguno de sus vecinos está vivo
+#pragma omp parallel for private(tj) schedule(static)
+  for (ti = 0; ti < T; ti++) {
+    for (tj = 0; tj < K; tj++) {
+      int a, b, activo = 0;
+      for (a = ti - 1; a <= ti + 1 && !activo; a++) {
+        for (b = tj - 1; b <= tj + 1 && !activo; b++) {
+          if (a >= 0 && a < T && b >= 0 && b < K) {
+            activo = F->vivas[a * K + b];
+          }
+        }
+      }
+      F->activas[ti * K + tj] = activo;
+    }
+  }
+}
+
+// Siguiente tramo [j0, j1) de columnas interiores activas de la fila local
+// i, a partir del final *j1 del tramo anterior (empezar con *j1 = 0).  Los
+// tiles activos consecutivos se juntan en un solo tramo.  Sin mapa de
+// actividad la fila entera es un tramo.  Devuelve 0 cuando no quedan tramos.
+int siguienteTramo(const franjaLocal *F, int i, int *j0, int *j1) {
+  int K = F->columnasTiles;
+  const unsigned char *fila;
+  int tj = *j1 / lado_tile;
+  if (F->activas == NULL) {
+    *j0 = 1;
+    *j1 = F->columnas - 1;
+    return tj == 0;
+  }
+  fila = F->activas + (i / lado_tile) * K;
+  while (tj < K && !fila[tj]) {
+    tj++;
+  }
+  if (tj >= K || *j1 >= F->columnas - 1) {
+    return 0;
+  }
+  *j0 = (tj * lado_tile < 1) ? 1 : tj * lado_tile;
+  while (tj < K && fila[tj]) {
+    tj++;
+  }
+  *j1 = (tj * lado_tile > F->columnas - 1) ? F->columnas - 1 : tj * lado_tile;
+  return 1;
+}
+
+// Revisa si la columna de tiles tj tiene algún tile activo en las filas de
+// tiles [a0, a1].
+static inline int columnaActiva(const franjaLocal *F, int a0, int a1,
+                                int tj) {
+  int a;
+  for (a = a0; a <= a1; a++) {
+    if (F->activas[a * F->columnasTiles + tj]) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Como siguienteTramo, pero con los tramos donde la fila i, la anterior o la
+// siguiente tienen tiles activos, agrandados una columna a cada lado.  Son
+// las celdas de la fila i que leen los flujos de las filas vecinas.
+int siguienteTramoVecino(const franjaLocal *F, int i, int *j0, int *j1) {
+  int K = F->columnasTiles, C = F->columnas;
+  int a0 = (i > 0) ? (i - 1) / lado_tile : 0;
+  int a1 = (i + 1) / lado_tile;
+  int tj = *j1 / lado_tile;
+  if (*j1 >= C - 1) {
+    return 0;
+  }
+  if (F->activas == NULL) {
+    *j0 = 1;
+    *j1 = C - 1;
+    return 1;
+  }
+  if (a1 >= F->filasTiles) {
+    a1 = F->filasTiles - 1;
+  }
+  while (tj < K && !columnaActiva(F, a0, a1, tj)) {
+    tj++;
+  }
+  if (tj >= K) {
+    return 0;
+  }
+  *j0 = (tj * lado_tile - 1 < 1) ? 1 : tj * lado_tile - 1;
+  while (tj < K && columnaActiva(F, a0, a1, tj)) {
+    tj++;
+  }
+  *j1 = (tj * lado_tile + 1 > C - 1) ? C - 1 : tj * lado_tile + 1;
+  return 1;
+}
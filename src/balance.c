@@ -0,0 +1,143 @@
+/*
+Balance de carga entre las franjas.  Con el mapa de actividad el trabajo de
+un paso está en los tiles activos, alrededor de los cráteres y de la lava;
+con franjas del mismo número de filas, el proceso que tiene los cráteres
+calcula casi todo mientras los demás esperan en el intercambio del halo.
+
+Con -b pasos, cada tantos pasos se comparan los tiempos de cálculo de las
+franjas (FuncionPrincipal sin la espera del halo).  Si la más lenta pasa
+del promedio en más de desbalance_maximo, se estima el trabajo de cada
+fila propia y se mueven las fronteras para que todas las franjas tengan el
+mismo; las filas que cambian de dueño se mandan con MPI (ver moverFranjas
+en dominio.c).  Una celda se calcula igual en cualquier franja, así que
+mover las fronteras no cambia los resultados.
+
+El trabajo de una fila son sus celdas activas más una celda por tile, lo
+que cuesta recorrer el mapa de actividad de una fila seca.  Las filas de
+cada franja se escalan para que sumen su tiempo medido, así se cuenta
+también lo que de verdad cuesta una celda en cada proceso.  Las fronteras
+nuevas parten el trabajo total en partes iguales, con al menos filas_halo
+filas por franja, y solo se usan si la franja más cargada baja al menos
+mejora_minima.
+*/
+
+#include "scalaf.h"
+#include <stdlib.h>
+
+// tiempo de la franja más lenta entre el promedio que ya se balancea
+#define desbalance_maximo 1.1
+// fracción del tiempo de la franja más lenta que debe bajar el balance
+#define mejora_minima 0.05
+
+// Trabajo de cada fila propia de la franja, escalado para sumar tiempo.
+static void pesosFilas(const franjaLocal *F, double *pesos, double tiempo) {
+  int i, j0, j1;
+  double fijo = (F->activas != NULL) ? F->columnasTiles : 0, suma = 0;
+  for (i = 0; i < F->filasPropias; i++) {
+    pesos[i] = fijo;
+    j1 = 0;
+    while (siguienteTramo(F, filas_halo + i, &j0, &j1)) {
+      pesos[i] += j1 - j0;
+    }
+    suma += pesos[i];
+  }
+  for (i = 0; i < F->filasPropias; i++) {
+    pesos[i] = (suma > 0) ? pesos[i] * tiempo / suma : 0;
+  }
+}
+
+// Fronteras que parten el trabajo de las filas 1..filas (pesos[g] es el de
+// la fila g) en size partes iguales, con al menos filas_halo filas por
+// franja.  Devuelve el trabajo de la franja más cargada.
+static double cortarFranjas(const double *pesos, int filas, int size,
+                            int *inicios) {
+  double total = 0, acumulado = 0, maximo = 0, franja;
+  int g, r;
+  for (g = 1; g <= filas; g++) {
+    total += pesos[g];
+  }
+  inicios[0] = 1;
+  inicios[size] = filas + 1;
+  g = 1;
+  for (r = 1; r < size; r++) {
+    // la fila va a la franja donde queda la mayor parte de su trabajo
+    while (g <= filas && acumulado + pesos[g] / 2 < total * r / size) {
+      acumulado += pesos[g];
+      g++;
+    }
+    inicios[r] = g;
+  }
+  for (r = 1; r < size; r++) {
+    if (inicios[r] < inicios[r - 1] + filas_halo) {
+      inicios[r] = inicios[r - 1] + filas_halo;
+    }
+  }
+  for (r = size - 1; r > 0; r--) {
+    if (inicios[r] > inicios[r + 1] - filas_halo) {
+      inicios[r] = inicios[r + 1] - filas_halo;
+    }
+  }
+  for (r = 0; r < size; r++) {
+    franja = 0;
+    for (g = inicios[r]; g < inicios[r + 1]; g++) {
+      franja += pesos[g];
+    }
+    maximo = (franja > maximo) ? franja : maximo;
+  }
+  return maximo;
+}
+
+// Revisa el balance con los tiempos desde la revisión anterior y mueve las
+// fronteras de las franjas si hace falta.  Todos los procesos deben
+// llamarla.  Devuelve el desbalance que se corrigió (tiempo de la franja
+// más lenta entre el promedio), o 0 si las fronteras no se movieron.
+double balancearFranjas(franjaLocal *F) {
+  double tiempo = F->segundosCalculo, total = 0, lento = 0, nuevo;
+  double *tiempos, *pesos = NULL, desbalance = 0;
+  int *inicios = NULL, r, ok, cambia = 0;
+  F->segundosCalculo = 0;
+  if (F->size < 2) {
+    return 0;
+  }
+  tiempos = (double *)malloc(F->size * sizeof(double));
+  ok = tiempos != NULL;
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if (!ok) {
+    free(tiempos);
+    return 0;
+  }
+  MPI_Allgather(&tiempo, 1, MPI_DOUBLE, tiempos, 1, MPI_DOUBLE,
+                MPI_COMM_WORLD);
+  for (r = 0; r < F->size; r++) {
+    total += tiempos[r];
+    lento = (tiempos[r] > lento) ? tiempos[r] : lento;
+  }
+  free(tiempos);
+  if (lento <= desbalance_maximo * total / F->size) {
+    return 0;
+  }
+
+  // el trabajo de todas las filas, en el lugar de su fila en la matriz
+  // agrandada
+  pesos = (double *)malloc((F->filas + 1) * sizeof(double));
+  inicios = (int *)malloc((F->size + 1) * sizeof(int));
+  ok = pesos && inicios;
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if (ok) {
+    pesosFilas(F, pesos + F->filaInicio, tiempo);
+    MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, pesos, F->conteos,
+                   F->desplazamientos, MPI_DOUBLE, MPI_COMM_WORLD);
+    nuevo = cortarFranjas(pesos, F->filas, F->size, inicios);
+    for (r = 0; r < F->size; r++) {
+      cambia = cambia || inicios[r] != F->desplazamientos[r];
+    }
+    // todos los procesos calculan lo mismo, así que todos deciden igual
+    if (cambia && nuevo < (1 - mejora_minima) * lento &&
+        moverFranjas(F, inicios, 1)) {
+      desbalance = lento * F->size / total;
+    }
+  }
+  free(pesos);
+  free(inicios);
+  return desbalance;
+}
@@ -0,0 +1,325 @@
+/*
+Bloques temporales.  Cada paso de FuncionPrincipal recorre los tramos
+activos de la franja varias veces (reología, salidas y flujos,
+consolidación) y con mapas grandes cada recorrido trae los campos desde la
+memoria.  Con -u pasos (--temporal-blocking) la franja se parte en bloques
+de lado_bloque x lado_bloque celdas y cada bloque avanza varios pasos
+seguidos mientras sus campos están en la caché, antes de pasar al
+siguiente; los campos de la franja se leen y se escriben una vez por
+bloque de pasos en lugar de una vez por paso.
+
+Los bloques se solapan: el grosor y la temperatura de una celda después de
+un paso dependen de las celdas a distancia 2 (los flujos dependen de las
+salidas de las vecinas, y las salidas de las vecinas de éstas), así que
+para avanzar un bloque k pasos se copian sus celdas con 2k celdas más a
+cada lado.  Cada paso se calcula en una región 2 celdas más chica por lado
+que el anterior y el último deja bien solo las celdas propias del bloque;
+las celdas de más se calculan también en los bloques vecinos.  Dentro del
+bloque las tres fases van en una sola pasada por filas: la reología y las
+salidas de la fila r, los flujos de la fila r - 1 y la consolidación de la
+fila r - 2, que ya no leen las filas anteriores.  Los bloques nuevos se
+guardan aparte y se copian a la franja cuando todos terminaron, porque los
+bloques vecinos todavía leen los valores del principio.
+
+En cada bloque se calculan solo los tramos de los tiles activos al
+principio, con los mismos siguienteTramo y siguienteTramoVecino del paso a
+paso.  La lava avanza a lo sumo una celda por paso y los tiles activos
+cubren lado_tile celdas alrededor de la lava, así que en k <= lado_tile
+pasos solo cambian celdas de esos tiles; fuera de ellos una celda seca
+rodeada de celdas secas no cambia, calculada o no (ver actividad.c).  Los
+bloques sin tiles activos no se copian.  El grosor y la temperatura son
+idénticos a los del paso a paso.  Los campos de trabajo de la franja
+(viscosity, yield, exits y los flujos) no se actualizan, se recalculan en
+cada paso antes de usarse.
+
+Los bloques necesitan que nada fuera del proceso cambie durante sus pasos,
+así que solo se usan con un proceso y dt fijo; main corta los bloques en
+los pasos con instantánea o punto de reinicio.  En la medición el cálculo
+de los bloques va en la fase salidas_flujos, la copia a la franja en la de
+consolidación, y cada bloque queda como un registro con las celdas de
+todos sus pasos.
+
+En un terreno plano de 4096 x 4096 con 1024 cráteres, con un núcleo, L3 de
+300 MB y los núcleos AVX2, los bloques de 5 pasos tardan entre 10% y 20%
+más que el paso a paso: ahí el cálculo (pow, exp y divisiones) pesa más
+que el tráfico con la memoria, y las celdas de más se calculan dos veces.
+Pueden convenir con muchos hilos por proceso, cuando el ancho de banda por
+hilo es lo que limita.
+*/
+
+#include "scalaf.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// lado, en celdas, de las celdas propias de un bloque; múltiplo de lado_tile
+#define lado_bloque (4 * lado_tile)
+// pasos máximos de un bloque.  Con 8 pasos un bloque con sus celdas de más
+// ocupa unos 2.5 MB en double, todavía en la caché de último nivel
+#define pasos_bloque_maximo 8
+
+static inline int maximo(int a, int b) { return (a > b) ? a : b; }
+static inline int minimo(int a, int b) { return (a < b) ? a : b; }
+
+int crearBloques(bloquesTemporales *B, const franjaLocal *F, int pasos) {
+  size_t n = (size_t)F->celdas.filas * F->columnas;
+  int lado, h, ok;
+  memset(B, 0, sizeof(*B));
+  B->pasos = minimo(maximo(pasos, 1), pasos_bloque_maximo);
+  B->filasBloques = (F->celdas.filas + lado_bloque - 1) / lado_bloque;
+  B->columnasBloques = (F->columnas + lado_bloque - 1) / lado_bloque;
+  B->hilos = F->hilos;
+  lado = lado_bloque + 4 * B->pasos;
+  // las celdas que no se calculan no ocupan memoria
+  B->thickness = (real *)reservarArreglo(n * sizeof(real));
+  B->temperature = (real *)reservarArreglo(n * sizeof(real));
+  B->calcular = (unsigned char *)calloc(
+      (size_t)B->filasBloques * B->columnasBloques, 1);
+  B->celdas = (mapGrid *)calloc(B->hilos, sizeof(mapGrid));
+  B->cedidos =
+      (double *)calloc((size_t)B->hilos * 24 * lado, sizeof(double));
+  ok = B->thickness && B->temperature && B->calcular && B->celdas &&
+       B->cedidos;
+  for (h = 0; h < B->hilos && ok; h++) {
+    ok = crearMalla(&B->celdas[h], lado, lado) &&
+         crearDistancias(&B->celdas[h]);
+  }
+  if (!ok) {
+    liberarBloques(B);
+    return 0;
+  }
+  return 1;
+}
+
+void liberarBloques(bloquesTemporales *B) {
+  int h;
+  for (h = 0; h < B->hilos && B->celdas != NULL; h++) {
+    liberarMalla(&B->celdas[h]);
+  }
+  liberarArreglo(B->thickness);
+  liberarArreglo(B->temperature);
+  free(B->calcular);
+  free(B->celdas);
+  free(B->cedidos);
+  B->thickness = B->temperature = NULL;
+  B->calcular = NULL;
+  B->celdas = NULL;
+  B->cedidos = NULL;
+  B->hilos = 0;
+}
+
+// Celdas propias [a0, a1) x [b0, b1) del bloque (bi, bj), en filas locales
+// de la franja.  Devuelve 0 si no tiene ninguna.
+static int celdasBloque(const franjaLocal *F, int bi, int bj, int *a0,
+                        int *a1, int *b0, int *b1) {
+  *a0 = maximo(bi * lado_bloque, filas_halo);
+  *a1 = minimo((bi + 1) * lado_bloque, filas_halo + F->filasPropias);
+  *b0 = maximo(bj * lado_bloque, 1);
+  *b1 = minimo((bj + 1) * lado_bloque, F->columnas - 1);
+  return *a0 < *a1 && *b0 < *b1;
+}
+
+// Revisa si el bloque (bi, bj) tiene algún tile activo.
+static int bloqueActivo(const franjaLocal *F, int bi, int bj) {
+  int a, b, lado = lado_bloque / lado_tile;
+  if (F->activas == NULL) {
+    return 1;
+  }
+  for (a = bi * lado; a < minimo((bi + 1) * lado, F->filasTiles); a++) {
+    for (b = bj * lado; b < minimo((bj + 1) * lado, F->columnasTiles); b++) {
+      if (F->activas[a * F->columnasTiles + b]) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// Siguiente tramo [k0, k1) de tramo (siguienteTramo o siguienteTramoVecino)
+// de la fila i recortado a las columnas [h0, h1); empezar con *j1 = -1.
+// *j1 sigue al tramo sin recortar.  Devuelve 0 cuando no quedan tramos.
+static int tramoRecortado(const franjaLocal *F, int i, int h0, int h1,
+                          int (*tramo)(const franjaLocal *, int, int *,
+                                       int *),
+                          int *j0, int *j1, int *k0, int *k1) {
+  if (*j1 < 0) {
+    // los tramos de siguienteTramoVecino empiezan una columna antes de su
+    // tile, así que se busca desde el tile de la columna h0 - 1; sin mapa
+    // de actividad la fila entera es un solo tramo
+    *j1 = (F->activas != NULL && h0 > 0) ? h0 - 1 : 0;
+  }
+  while (*j1 < h1 && tramo(F, i, j0, j1)) {
+    *k0 = maximo(*j0, h0);
+    *k1 = minimo(*j1, h1);
+    if (*k0 < *k1) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Un paso del bloque T, que empieza en la fila e0 y la columna x0 de la
+// franja: grosor y temperatura nuevos de las filas [f0, f1) y columnas
+// [h0, h1) de la franja.  anillo tiene los volúmenes cedidos de tres filas
+// de T.
+static void pasoBloque(const franjaLocal *F, mapGrid *T, double *const *anillo,
+                       int e0, int x0, int f0, int f1, int h0, int h1) {
+  int p0 = filas_halo, p1 = filas_halo + F->filasPropias;
+  int C = T->columnas, r, d, k;
+  for (r = f0 - 1; r <= f1 + 1; r++) {
+    int j0, j1, k0, k1;
+    if (r <= f1) {
+      // volúmenes que cede la fila r, que leen los flujos de r - 1 a r + 1;
+      // las filas de los bordes de la matriz agrandada no ceden nada
+      double *const *cedido = anillo + (r % 3) * 8;
+      int t = r - e0;
+      if (r < p0 || r >= p1) {
+        for (d = 0; d < 8; d++) {
+          memset(cedido[d], 0, C * sizeof(double));
+        }
+      }
+      j1 = -1;
+      while (r >= p0 && r < p1 &&
+             tramoRecortado(F, r, h0 - 1, h1 + 1, siguienteTramoVecino, &j0,
+                            &j1, &k0, &k1)) {
+        nucleos.reologia(&T->temperature[t * C + k0 - x0],
+                         &T->viscosity[t * C + k0 - x0],
+                         &T->yield[t * C + k0 - x0], k1 - k0);
+        nucleos.salidas(T, t, k0 - x0, k1 - x0, cedido, 0);
+      }
+    }
+    if (r - 1 >= f0 && r - 1 < f1) {
+      double *filas[24];
+      for (k = 0; k < 3; k++) {
+        for (d = 0; d < 8; d++) {
+          filas[k * 8 + d] = anillo[((r - 2 + k) % 3) * 8 + d];
+        }
+      }
+      j1 = -1;
+      while (tramoRecortado(F, r - 1, h0, h1, siguienteTramo, &j0, &j1, &k0,
+                            &k1)) {
+        nucleos.flujos(T, r - 1 - e0, k0 - x0, k1 - x0, filas);
+      }
+    }
+    if (r - 2 >= f0 && r - 2 < f1) {
+      // los flujos de las filas r - 1 y r ya leyeron la temperatura de r - 2
+      j1 = -1;
+      while (tramoRecortado(F, r - 2, h0, h1, siguienteTramo, &j0, &j1, &k0,
+                            &k1)) {
+        consolidarTramo(T, r - 2 - e0, k0 - x0, k1 - x0, NULL, NULL);
+      }
+    }
+  }
+}
+
+// Avanza pasos pasos el bloque (bi, bj) en el espacio del hilo h y deja el
+// grosor y la temperatura nuevos de sus tramos activos en B.
+static void calcularBloque(bloquesTemporales *B, const franjaLocal *F,
+                           int bi, int bj, int pasos, int h) {
+  const mapGrid *A = &F->celdas;
+  mapGrid *T = &B->celdas[h];
+  double *anillo[24];
+  size_t plano, planoT;
+  int a0, a1, b0, b1, e0, e1, x0, x1, i, d, s, j0, j1, k0, k1;
+  int C = F->columnas, margen = 2 * pasos;
+  if (!celdasBloque(F, bi, bj, &a0, &a1, &b0, &b1)) {
+    return;
+  }
+  // las celdas de más, recortadas a la matriz agrandada con sus bordes
+  e0 = maximo(a0 - margen, filas_halo - 1);
+  e1 = minimo(a1 + margen, filas_halo + F->filasPropias + 1);
+  x0 = maximo(b0 - margen, 0);
+  x1 = minimo(b1 + margen, C);
+  T->filas = e1 - e0;
+  T->columnas = x1 - x0;
+  plano = (size_t)A->filas * C;
+  planoT = (size_t)T->filas * T->columnas;
+  for (i = e0; i < e1; i++) {
+    size_t k = (size_t)i * C + x0, t = (size_t)(i - e0) * T->columnas;
+    size_t n = T->columnas;
+    memcpy(&T->altitude[t], &A->altitude[k], n * sizeof(real));
+    memcpy(&T->thickness[t], &A->thickness[k], n * sizeof(real));
+    memcpy(&T->temperature[t], &A->temperature[k], n * sizeof(real));
+    memcpy(&T->isVent[t], &A->isVent[k], n * sizeof(char));
+    for (d = 0; d < 4; d++) {
+      memcpy(&T->distancia[d * planoT + t], &A->distancia[d * plano + k],
+             n * sizeof(real));
+    }
+  }
+  // en 0 quedan las columnas de los bordes, que nunca ceden
+  memset(B->cedidos + (size_t)h * 24 * (lado_bloque + 4 * B->pasos), 0,
+         24 * T->columnas * sizeof(double));
+  for (d = 0; d < 24; d++) {
+    anillo[d] = B->cedidos + (size_t)h * 24 * (lado_bloque + 4 * B->pasos) +
+                (size_t)d * T->columnas;
+  }
+  for (s = 1; s <= pasos; s++) {
+    int m = 2 * (pasos - s);
+    pasoBloque(F, T, anillo, e0, x0, maximo(a0 - m, filas_halo),
+               minimo(a1 + m, filas_halo + F->filasPropias),
+               maximo(b0 - m, 1), minimo(b1 + m, C - 1));
+  }
+  for (i = a0; i < a1; i++) {
+    j1 = -1;
+    while (tramoRecortado(F, i, b0, b1, siguienteTramo, &j0, &j1, &k0, &k1)) {
+      size_t k = (size_t)i * C + k0;
+      size_t t = (size_t)(i - e0) * T->columnas + k0 - x0;
+      memcpy(&B->thickness[k], &T->thickness[t], (k1 - k0) * sizeof(real));
+      memcpy(&B->temperature[k], &T->temperature[t],
+             (k1 - k0) * sizeof(real));
+    }
+  }
+}
+
+// Copia a la franja el grosor y la temperatura nuevos del bloque (bi, bj).
+static void copiarBloque(const bloquesTemporales *B, franjaLocal *F, int bi,
+                         int bj) {
+  int a0, a1, b0, b1, i, j0, j1, k0, k1;
+  if (!celdasBloque(F, bi, bj, &a0, &a1, &b0, &b1)) {
+    return;
+  }
+  for (i = a0; i < a1; i++) {
+    j1 = -1;
+    while (tramoRecortado(F, i, b0, b1, siguienteTramo, &j0, &j1, &k0, &k1)) {
+      size_t k = (size_t)i * F->columnas + k0;
+      memcpy(&F->celdas.thickness[k], &B->thickness[k],
+             (k1 - k0) * sizeof(real));
+      memcpy(&F->celdas.temperature[k], &B->temperature[k],
+             (k1 - k0) * sizeof(real));
+    }
+  }
+}
+
+// Avanza la franja pasos pasos (a lo sumo B->pasos) por bloques y
+// actualiza el mapa de actividad.  Solo con un proceso y dt fijo.
+void avanzarBloque(bloquesTemporales *B, franjaLocal *F, int pasos) {
+  int b, n = B->filasBloques * B->columnasBloques, K = B->columnasBloques;
+  double t = marcaFase();
+  for (b = 0; b < n; b++) {
+    B->calcular[b] = bloqueActivo(F, b / K, b % K);
+  }
+#pragma omp parallel for schedule(dynamic, 1)
+  for (b = 0; b < n; b++) {
+    int h = 0;
+#ifdef _OPENMP
+    h = omp_get_thread_num();
+#endif
+    if (B->calcular[b]) {
+      calcularBloque(B, F, b / K, b % K, pasos, h);
+    }
+  }
+  sumarFase(fase_salidas_flujos, t);
+  t = marcaFase();
+#pragma omp parallel for schedule(dynamic, 1)
+  for (b = 0; b < n; b++) {
+    if (B->calcular[b]) {
+      copiarBloque(B, F, b / K, b % K);
+    }
+  }
+  sumarFase(fase_consolidacion, t);
+  t = marcaFase();
+  actualizarActividad(F, 0);
+  sumarFase(fase_actividad, t);
+}
@@ -0,0 +1,312 @@
+/*
+Conjunto de escenarios (ensemble) sobre un mismo terreno.  El terreno se
+lee una sola vez y queda en memoria compartida entre los procesos de cada
+nodo (una ventana MPI compartida); cada proceso simula escenarios completos,
+uno a la vez, sobre su propia copia de la malla.
+
+Los escenarios se reparten dinámicamente: cada proceso que termina uno toma
+el siguiente de un contador atómico en el proceso 0, así los procesos con
+escenarios cortos hacen más escenarios.  Los escenarios corren en procesos y
+no en hilos porque c0 es global; los hilos de OpenMP siguen repartiendo las
+filas de cada escenario.
+
+El archivo de escenarios tiene una línea por escenario:
+
+  temperatura,velocidad,fila,columna[,fila,columna...]
+
+con la temperatura y la velocidad de erupción y la fila y columna de cada
+cráter (en el mapa sin agrandar), a lo sumo crateres_escenario cráteres.
+Las líneas vacías o que empiezan con # se ignoran.  El estado final del
+escenario k (desde 0) se escribe como instantánea binaria
+etiqueta_k_<último paso>.scf, junto al terreno etiqueta_terreno.bin.  Al
+terminar todos los escenarios se escribe además el mapa de peligro del
+conjunto, etiqueta_peligro.scp (ver peligro.c).
+*/
+
+#include "scalaf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// cráteres por escenario como máximo
+#define crateres_escenario 64
+
+typedef struct {
+  double temperatura;
+  double velocidad;
+  int numCrateres;
+  point2D crateres[crateres_escenario];
+} escenario;
+
+// Lee los escenarios del archivo.  Devuelve cuántos leyó, o -1 si el
+// archivo no existe o una línea está mal.
+static int leerEscenarios(const char *path, escenario **lista) {
+  FILE *archivo = fopen(path, "r");
+  char linea[4096];
+  int n = 0, capacidad = 0, numLinea = 0;
+  *lista = NULL;
+  if (archivo == NULL) {
+    return -1;
+  }
+  while (fgets(linea, sizeof(linea), archivo) != NULL) {
+    escenario e;
+    char *p = linea, *fin;
+    numLinea++;
+    while (*p == ' ' || *p == '\t') {
+      p++;
+    }
+    if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') {
+      continue;
+    }
+    e.temperatura = strtod(p, &fin);
+    p = (*fin == ',') ? fin + 1 : NULL;
+    e.velocidad = p ? strtod(p, &fin) : 0;
+    e.numCrateres = 0;
+    while (p && *fin == ',' && e.numCrateres < crateres_escenario) {
+      point2D *c = &e.crateres[e.numCrateres];
+      c->x = strtol(fin + 1, &fin, 10);
+      if (*fin != ',') {
+        p = NULL;
+        break;
+      }
+      c->y = strtol(fin + 1, &fin, 10);
+      e.numCrateres++;
+    }
+    if (p && *fin == ',') {
+      // recortar los cráteres cambiaría el escenario sin avisar
+      printf("\nERROR: línea %d de %s: el escenario tiene más de %d "
+             "cráteres\n",
+             numLinea, path, crateres_escenario);
+      fclose(archivo);
+      free(*lista);
+      *lista = NULL;
+      return -1;
+    }
+    if (p == NULL || e.numCrateres == 0) {
+      printf("\nERROR: línea %d de %s: se espera "
+             "temperatura,velocidad,fila,columna[,fila,columna...]\n",
+             numLinea, path);
+      fclose(archivo);
+      free(*lista);
+      *lista = NULL;
+      return -1;
+    }
+    if (n == capacidad) {
+      escenario *mas;
+      capacidad = capacidad ? 2 * capacidad : 16;
+      mas = (escenario *)realloc(*lista, capacidad * sizeof(escenario));
+      if (mas == NULL) {
+        fclose(archivo);
+        free(*lista);
+        *lista = NULL;
+        return -1;
+      }
+      *lista = mas;
+    }
+    (*lista)[n++] = e;
+  }
+  fclose(archivo);
+  return n;
+}
+
+// Siguiente escenario por simular, del contador del proceso 0.
+static int siguienteEscenario(MPI_Win contador) {
+  int uno = 1, k;
+  MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, contador);
+  MPI_Fetch_and_op(&uno, &k, MPI_INT, 0, 0, MPI_SUM, contador);
+  MPI_Win_unlock(0, contador);
+  return k;
+}
+
+// Pone en la franja F (un solo proceso, todo el mapa) el estado inicial del
+// escenario e sobre la altitud de la matriz agrandada, igual que lo dejan
+// los lectores del terreno y placeCraters.
+static void cargarEscenario(franjaLocal *F, const real *altitud,
+                            const escenario *e) {
+  mapGrid *L = &F->celdas;
+  int i, j, c, C = F->columnas;
+  for (i = 0; i < L->filas; i++) {
+    int g = i + F->filaInicio - filas_halo; // fila de la matriz agrandada
+    for (j = 0; j < C; j++) {
+      int k = i * C + j;
+      celdaBorde(L, k);
+      if (g > 0 && g <= F->filas && j > 0 && j < C - 1) {
+        L->altitude[k] = altitud[(size_t)g * C + j];
+        L->temperature[k] = 273.0;
+      } else if (g >= 0 && g <= F->filas + 1) {
+        L->altitude[k] = altitud[(size_t)g * C + j];
+      }
+    }
+  }
+  for (c = 0; c < e->numCrateres; c++) {
+    int fila = e->crateres[c].x, columna = e->crateres[c].y;
+    if (fila > -1 && fila < F->filas && columna > -1 && columna < C - 2) {
+      L->isVent[(fila + 1 - F->filaInicio + filas_halo) * C + columna + 1] =
+          1;
+    }
+  }
+  c0.eruptionTemperature = e->temperatura;
+  c0.eruptionRate = e->velocidad;
+  calcularDistancias(L);
+  liberarActividad(F);
+  crearActividad(F);
+}
+
+// Matriz agrandada (filas + 2) x columnas dentro de la franja F de un solo
+// proceso, sin copiar.
+static mapGrid agrandadaDeFranja(const franjaLocal *F) {
+  mapGrid A = F->celdas;
+  size_t d = (size_t)(filas_halo - F->filaInicio) * F->columnas;
+  A.filas = F->filas + 2;
+  A.altitude += d;
+  A.thickness += d;
+  A.temperature += d;
+  A.yield += d;
+  A.viscosity += d;
+  A.inboundV += d;
+  A.outboundV += d;
+  A.inboundQ += d;
+  A.exits += d;
+  A.isVent += d;
+  return A;
+}
+
+// Simula todos los escenarios del archivo escenarios sobre el terreno
+// a_path (binario o CSV) con c0.timeSteps pasos cada uno.  Todos los
+// procesos deben llamarla.  Devuelve el número de escenarios simulados por
+// este proceso, o -1 si hubo un error.
+int simularConjunto(const char *escenarios, char *a_path, int terrenoBinario,
+                    const char *etiqueta) {
+  int rank, size, rankNodo, leido = 0, listo, numEscenarios, k, i;
+  int hechos = 0;
+  size_t n = (size_t)(c0.maxRows + 2) * (c0.maxColumns + 2);
+  MPI_Comm nodo, lideres;
+  MPI_Win ventanaTerreno, contador;
+  MPI_Aint tamano;
+  int unidad, *cuenta = NULL;
+  real *altitud;
+  double inicio;
+  escenario *lista;
+  franjaLocal F;
+  mapaPeligro peligro = {0};
+  char nombre[1100];
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  numEscenarios = leerEscenarios(escenarios, &lista);
+  if (numEscenarios < 0) {
+    if (rank == 0) {
+      printf("\nERROR: no se pudo leer el archivo de escenarios %s.\n",
+             escenarios);
+    }
+    return -1;
+  }
+
+  // la altitud de la matriz agrandada, una vez por nodo
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL,
+                      &nodo);
+  MPI_Comm_rank(nodo, &rankNodo);
+  MPI_Comm_split(MPI_COMM_WORLD, (rankNodo == 0) ? 0 : MPI_UNDEFINED, rank,
+                 &lideres);
+  MPI_Win_allocate_shared((rankNodo == 0) ? n * sizeof(real) : 0,
+                          sizeof(real), MPI_INFO_NULL, nodo, &altitud,
+                          &ventanaTerreno);
+  MPI_Win_shared_query(ventanaTerreno, 0, &tamano, &unidad, &altitud);
+  MPI_Win_fence(0, ventanaTerreno);
+  if (rank == 0) {
+    mapGrid terreno;
+    if (crearMalla(&terreno, c0.maxRows + 2, c0.maxColumns + 2)) {
+      leido = terrenoBinario ? leerTerrenoBinario(a_path, c0.maxRows,
+                                                  c0.maxColumns, &terreno)
+                             : readTerrainFile(a_path, c0.maxRows,
+                                               c0.maxColumns, &terreno);
+      if (leido) {
+        memcpy(altitud, terreno.altitude, n * sizeof(real));
+        snprintf(nombre, sizeof(nombre), "%s_terreno.bin", etiqueta);
+        if (!escribirTerrenoBinario(nombre, &terreno, c0.cellWidth,
+                                    sizeof(double))) {
+          printf("***\nError al intentar escribir el archivo %s.\n***\n",
+                 nombre);
+        }
+      }
+      liberarMalla(&terreno);
+    }
+  }
+  MPI_Bcast(&leido, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if (leido && rankNodo == 0) {
+    MPI_Bcast(altitud, n, mpi_real, 0, lideres);
+  }
+  MPI_Win_fence(0, ventanaTerreno);
+
+  // contador de escenarios repartidos, en el proceso 0
+  MPI_Win_allocate((rank == 0) ? sizeof(int) : 0, sizeof(int), MPI_INFO_NULL,
+                   MPI_COMM_WORLD, &cuenta, &contador);
+  if (rank == 0) {
+    *cuenta = 0;
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  // el mapa de peligro se junta entre todos, así que todos deben poder
+  // simular
+  listo = leido && crearFranja(&F, c0.maxRows, c0.maxColumns, 0, 1) &&
+          crearMapaPeligro(&peligro, c0.maxRows, c0.maxColumns);
+  MPI_Allreduce(MPI_IN_PLACE, &listo, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if (listo) {
+    if (rank == 0) {
+      printf("\nSimulando %d escenarios en %d procesos.\n", numEscenarios,
+             size);
+    }
+    while ((k = siguienteEscenario(contador)) < numEscenarios) {
+      mapGrid A;
+      inicio = MPI_Wtime();
+      cargarEscenario(&F, altitud, &lista[k]);
+      iniciarMiembro(&peligro);
+      for (i = 0; i < c0.timeSteps; i++) {
+        FuncionPrincipal(&F);
+        acumularPaso(&peligro, &F, i);
+      }
+      terminarMiembro(&peligro);
+      A = agrandadaDeFranja(&F);
+      snprintf(nombre, sizeof(nombre), "%s_%d_%d.scf", etiqueta, k,
+               c0.timeSteps - 1);
+      if (!escribirInstantaneaBinaria(nombre, &A, c0.timeSteps - 1,
+                                      sizeof(double), NULL)) {
+        printf("***\nError al intentar escribir el archivo %s.\n***\n",
+               nombre);
+      }
+      printf("Proceso %d: escenario %d (%.1lf K, %.2lf m3/s, %d cráteres) "
+             "en %.3lf s\n",
+             rank, k, lista[k].temperatura, lista[k].velocidad,
+             lista[k].numCrateres, MPI_Wtime() - inicio);
+      hechos++;
+    }
+    snprintf(nombre, sizeof(nombre), "%s_peligro.scp", etiqueta);
+    if (rank == 0) {
+      printf("\nEscribiendo el mapa de peligro %s\n", nombre);
+    }
+    if (!escribirMapaPeligro(&peligro, nombre, c0.timeSteps)) {
+      printf("***\nError al intentar escribir el archivo %s.\n***\n",
+             nombre);
+    }
+  } else {
+    if (leido && rank == 0) {
+      printf("\nERROR: no hay memoria para la malla en algún proceso.\n");
+    } else if (rank == 0) {
+      printf("\nERROR: no se pudo leer el terreno %s.\n", a_path);
+    }
+    hechos = -1;
+  }
+  liberarMapaPeligro(&peligro);
+  if (leido) {
+    liberarFranja(&F);
+  }
+
+  MPI_Win_free(&contador);
+  MPI_Win_free(&ventanaTerreno);
+  if (lideres != MPI_COMM_NULL) {
+    MPI_Comm_free(&lideres);
+  }
+  MPI_Comm_free(&nodo);
+  free(lista);
+  return hechos;
+}
@@ -0,0 +1,297 @@
+/*
+Descomposición del dominio en franjas de filas para la versión MPI.
+Cada proceso calcula un bloque contiguo de filas de la matriz agrandada y
+en cada paso de tiempo intercambia filas fantasma con sus vecinos.  Las
+franjas empiezan con el mismo número de filas; moverFranjas cambia las
+fronteras durante la simulación (ver balance.c).
+*/
+
+#include "scalaf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Filas propias iniciales del proceso rank, se reparten las filas
+// interiores (1..filas) en partes iguales: las primeras "resto" franjas
+// llevan una fila más.
+static void filasDelProceso(int filas, int rank, int size, int *inicio,
+                            int *fin) {
+  int porProceso = filas / size;
+  int resto = filas % size;
+  *inicio = 1 + rank * porProceso + (rank < resto ? rank : resto);
+  *fin = *inicio + porProceso + (rank < resto);
+}
+
+// Tipo MPI para una fila completa de un campo de la matriz agrandada.  Se
+// usa en lugar de contar elementos para que los conteos no se desborden en
+// mapas grandes.
+static MPI_Datatype tipoFila(int columnas, MPI_Datatype elemento) {
+  MPI_Datatype fila;
+  MPI_Type_contiguous(columnas, elemento, &fila);
+  MPI_Type_commit(&fila);
+  return fila;
+}
+
+// Conteos y desplazamientos (en filas de la matriz agrandada) de las franjas
+// de todos los procesos, para Scatterv y Gatherv.
+static void conteosFranjas(const franjaLocal *F, int *conteos,
+                           int *desplazamientos) {
+  int r, inicio, fin;
+  for (r = 0; r < F->size; ++r) {
+    filasDelProceso(F->filas, r, F->size, &inicio, &fin);
+    conteos[r] = fin - inicio;
+    desplazamientos[r] = inicio;
+  }
+}
+
+// Crea la franja del proceso para una matriz de filas x columnas (sin
+// agrandar).  Devuelve 0 si alguna franja queda con menos filas que las
+// filas fantasma, porque entonces el halo vendría de más de un vecino.
+int crearFranja(franjaLocal *F, int filas, int columnas, int rank, int size) {
+  int i;
+  F->rank = rank;
+  F->size = size;
+  F->filas = filas;
+  filasDelProceso(filas, rank, size, &F->filaInicio, &F->filaFin);
+  F->filasPropias = F->filaFin - F->filaInicio;
+  F->columnas = columnas + 2;
+  F->arriba = (rank > 0) ? rank - 1 : MPI_PROC_NULL;
+  F->abajo = (rank < size - 1) ? rank + 1 : MPI_PROC_NULL;
+  F->filasTiles = F->columnasTiles = 0;
+  F->vivas = F->activas = NULL;
+  F->segundosCalculo = 0;
+  F->hilos = 1;
+#ifdef _OPENMP
+  F->hilos = omp_get_max_threads();
+#endif
+  // en 0 quedan las columnas de los bordes, que nunca ceden
+  F->cedidos =
+      (double *)calloc((size_t)F->hilos * 24 * F->columnas, sizeof(double));
+  F->conteos = (int *)malloc(size * sizeof(int));
+  F->desplazamientos = (int *)malloc(size * sizeof(int));
+  F->filaReal = tipoFila(F->columnas, mpi_real);
+  F->filaChar = tipoFila(F->columnas, MPI_CHAR);
+  if (filas / size < filas_halo ||
+      !(F->conteos && F->desplazamientos && F->cedidos) ||
+      !crearMalla(&F->celdas, F->filasPropias + 2 * filas_halo,
+                  F->columnas)) {
+    F->celdas.filas = 0;
+    return 0;
+  }
+  if (!crearDistancias(&F->celdas)) {
+    liberarMalla(&F->celdas);
+    F->celdas.filas = 0;
+    return 0;
+  }
+  conteosFranjas(F, F->conteos, F->desplazamientos);
+  // todas las filas fantasma empiezan como borde, en los procesos de los
+  // extremos son las filas extras de la matriz agrandada y nunca cambian.
+  for (i = 0; i < F->celdas.filas * F->columnas; ++i) {
+    celdaBorde(&F->celdas, i);
+  }
+  return 1;
+}
+
+void liberarFranja(franjaLocal *F) {
+  liberarActividad(F);
+  free(F->conteos);
+  free(F->desplazamientos);
+  free(F->cedidos);
+  F->conteos = F->desplazamientos = NULL;
+  F->cedidos = NULL;
+  MPI_Type_free(&F->filaReal);
+  MPI_Type_free(&F->filaChar);
+  if (F->celdas.filas > 0) {
+    liberarMalla(&F->celdas);
+  }
+}
+
+// Filas de [a0, a1) que también están en [b0, b1); deja en *c0 la primera.
+static int filasComunes(int a0, int a1, int b0, int b1, int *c0) {
+  *c0 = (a0 > b0) ? a0 : b0;
+  return ((a1 < b1) ? a1 : b1) - *c0;
+}
+
+// Mueve las fronteras de las franjas: el proceso r queda con las filas
+// propias [inicios[r], inicios[r + 1]), con inicios[size] = filas + 1 y al
+// menos filas_halo filas en cada franja.  Con migrar en 1 cada proceso
+// recibe de los dueños anteriores todos los campos de sus filas propias y
+// fantasma nuevas, y se recalculan las distancias y el mapa de actividad;
+// con 0 la franja queda como recién creada, para leerla de un punto de
+// reinicio.  Todos los procesos deben llamarla con los mismos inicios.
+// Devuelve 0, sin cambiar ninguna franja, si algún proceso no tiene
+// memoria.
+int moverFranjas(franjaLocal *F, const int *inicios, int migrar) {
+  int inicio = inicios[F->rank], fin = inicios[F->rank + 1];
+  int r, c, ok, numCampos, conActividad = (F->activas != NULL);
+  int *envios = (int *)malloc(4 * F->size * sizeof(int));
+  int *desplazamientosEnvio = envios + F->size;
+  int *recibos = envios + 2 * F->size;
+  int *desplazamientosRecibo = envios + 3 * F->size;
+  void *origen[10], *destino[10];
+  size_t bytes[10];
+  mapGrid nueva;
+  nueva.filas = 0;
+  ok = envios != NULL &&
+       crearMalla(&nueva, fin - inicio + 2 * filas_halo, F->columnas);
+  ok = ok && crearDistancias(&nueva);
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if (!ok) {
+    if (nueva.filas > 0) {
+      liberarMalla(&nueva);
+    }
+    free(envios);
+    return 0;
+  }
+  // al migrar solo quedan sin llenar las filas de los bordes de la matriz
+  // agrandada
+  for (r = 0; r < nueva.filas; ++r) {
+    int g = inicio - filas_halo + r;
+    if (!migrar || g < 1 || g > F->filas) {
+      for (c = r * F->columnas; c < (r + 1) * F->columnas; ++c) {
+        celdaBorde(&nueva, c);
+      }
+    }
+  }
+  if (migrar) {
+    // cada fila interior la manda su dueño anterior a los procesos que la
+    // tienen como propia o fantasma en las franjas nuevas; las filas de los
+    // bordes de la matriz agrandada no son de nadie y quedan como borde
+    for (r = 0; r < F->size; ++r) {
+      int primera;
+      envios[r] = filasComunes(inicios[r] - filas_halo,
+                               inicios[r + 1] + filas_halo, F->filaInicio,
+                               F->filaFin, &primera);
+      desplazamientosEnvio[r] = primera - (F->filaInicio - filas_halo);
+      if (envios[r] <= 0) {
+        envios[r] = desplazamientosEnvio[r] = 0;
+      }
+      recibos[r] = filasComunes(inicio - filas_halo, fin + filas_halo,
+                                F->desplazamientos[r],
+                                F->desplazamientos[r] + F->conteos[r],
+                                &primera);
+      desplazamientosRecibo[r] = primera - (inicio - filas_halo);
+      if (recibos[r] <= 0) {
+        recibos[r] = desplazamientosRecibo[r] = 0;
+      }
+    }
+    numCampos = camposMalla(&F->celdas, origen, bytes);
+    camposMalla(&nueva, destino, bytes);
+    for (c = 0; c < numCampos; ++c) {
+      MPI_Datatype fila = tipoFila(F->columnas * (int)bytes[c], MPI_BYTE);
+      MPI_Alltoallv(origen[c], envios, desplazamientosEnvio, fila,
+                    destino[c], recibos, desplazamientosRecibo, fila,
+                    MPI_COMM_WORLD);
+      MPI_Type_free(&fila);
+    }
+  }
+  free(envios);
+  liberarActividad(F);
+  liberarMalla(&F->celdas);
+  F->celdas = nueva;
+  F->filaInicio = inicio;
+  F->filaFin = fin;
+  F->filasPropias = fin - inicio;
+  for (r = 0; r < F->size; ++r) {
+    F->conteos[r] = inicios[r + 1] - inicios[r];
+    F->desplazamientos[r] = inicios[r];
+  }
+  if (migrar) {
+    calcularDistancias(&F->celdas);
+  }
+  // sin memoria para el mapa de actividad se calcula toda la franja, igual
+  // que al empezar
+  if (conActividad) {
+    crearActividad(F);
+  }
+  return 1;
+}
+
+// Posición de la primera fila propia dentro de un campo de la franja.
+#define filasPropiasDe(F, campo) ((campo) + filas_halo * (F)->columnas)
+
+// Inicia el intercambio no bloqueante de las filas fantasma de un campo:
+// las primeras filas_halo filas propias van al vecino de arriba y las
+// últimas al de abajo.
+static void intercambiarCampo(franjaLocal *F, void *campo, size_t tamano,
+                              MPI_Datatype elemento, int etiqueta,
+                              MPI_Request *solicitudes) {
+  int C = F->columnas;
+  int n = filas_halo * C;
+  char *base = (char *)campo;
+  char *primeras = base + (size_t)filas_halo * C * tamano;
+  char *ultimas = base + (size_t)F->filasPropias * C * tamano;
+  char *haloAbajo = base + (size_t)(filas_halo + F->filasPropias) * C * tamano;
+  MPI_Irecv(base, n, elemento, F->arriba, 2 * etiqueta + 1, MPI_COMM_WORLD,
+            &solicitudes[0]);
+  MPI_Irecv(haloAbajo, n, elemento, F->abajo, 2 * etiqueta, MPI_COMM_WORLD,
+            &solicitudes[1]);
+  MPI_Isend(primeras, n, elemento, F->arriba, 2 * etiqueta, MPI_COMM_WORLD,
+            &solicitudes[2]);
+  MPI_Isend(ultimas, n, elemento, F->abajo, 2 * etiqueta + 1, MPI_COMM_WORLD,
+            &solicitudes[3]);
+}
+
+// Reparte las filas propias de la matriz agrandada A (solo válida en el
+// proceso 0) entre las franjas de todos los procesos.  Los campos que no
+// cambian durante la simulación (altitud y cráteres) se intercambian una
+// sola vez con los vecinos; el grosor y la temperatura también, para que el
+// mapa de actividad inicial vea el halo.
+void repartirFranjas(const mapGrid *A, franjaLocal *F) {
+  MPI_Request solicitudes[8];
+  mapGrid *L = &F->celdas;
+  MPI_Scatterv(F->rank == 0 ? A->altitude : NULL, F->conteos,
+               F->desplazamientos, F->filaReal,
+               filasPropiasDe(F, L->altitude), F->filasPropias, F->filaReal,
+               0, MPI_COMM_WORLD);
+  MPI_Scatterv(F->rank == 0 ? A->thickness : NULL, F->conteos,
+               F->desplazamientos, F->filaReal,
+               filasPropiasDe(F, L->thickness), F->filasPropias, F->filaReal,
+               0, MPI_COMM_WORLD);
+  MPI_Scatterv(F->rank == 0 ? A->temperature : NULL, F->conteos,
+               F->desplazamientos, F->filaReal,
+               filasPropiasDe(F, L->temperature), F->filasPropias,
+               F->filaReal, 0, MPI_COMM_WORLD);
+  MPI_Scatterv(F->rank == 0 ? A->isVent : NULL, F->conteos,
+               F->desplazamientos, F->filaChar, filasPropiasDe(F, L->isVent),
+               F->filasPropias, F->filaChar, 0, MPI_COMM_WORLD);
+  intercambiarCampo(F, L->altitude, sizeof(real), mpi_real, 0,
+                    solicitudes);
+  intercambiarCampo(F, L->isVent, sizeof(char), MPI_CHAR, 1,
+                    solicitudes + 4);
+  MPI_Waitall(8, solicitudes, MPI_STATUSES_IGNORE);
+  iniciarIntercambioHalo(F, solicitudes);
+  terminarIntercambioHalo(solicitudes);
+}
+
+// Reúne el grosor y la temperatura de las filas propias de todas las franjas
+// en la matriz agrandada A del proceso 0, que ya tiene los campos que no
+// cambian.  Las filas de los bordes de A no se tocan.  Los tipos y conteos
+// son los de la franja, así que en los pasos no se reserva memoria.
+void reunirFranjas(const franjaLocal *F, mapGrid *A) {
+  const mapGrid *L = &F->celdas;
+  MPI_Gatherv(filasPropiasDe(F, L->thickness), F->filasPropias, F->filaReal,
+              F->rank == 0 ? A->thickness : NULL, F->conteos,
+              F->desplazamientos, F->filaReal, 0, MPI_COMM_WORLD);
+  MPI_Gatherv(filasPropiasDe(F, L->temperature), F->filasPropias,
+              F->filaReal, F->rank == 0 ? A->temperature : NULL, F->conteos,
+              F->desplazamientos, F->filaReal, 0, MPI_COMM_WORLD);
+}
+
+// Inicia el intercambio no bloqueante de las filas fantasma del grosor y la
+// temperatura, los únicos campos de los vecinos que cambian en cada paso.
+// Las filas propias que se envían solo se modifican al consolidar, después
+// de terminarIntercambioHalo, así que se envían sin copiarlas.  Las filas
+// fantasma no se pueden leer hasta terminar el intercambio.
+void iniciarIntercambioHalo(franjaLocal *F, MPI_Request *solicitudes) {
+  intercambiarCampo(F, F->celdas.thickness, sizeof(real), mpi_real, 2,
+                    solicitudes);
+  intercambiarCampo(F, F->celdas.temperature, sizeof(real), mpi_real, 3,
+                    solicitudes + 4);
+}
+
+void terminarIntercambioHalo(MPI_Request *solicitudes) {
+  MPI_Waitall(8, solicitudes, MPI_STATUSES_IGNORE);
+}
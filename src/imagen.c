@@ -0,0 +1,470 @@
+/*
+Imágenes PNG de las instantáneas, generadas dentro del programa en lugar de
+llamar a gnuplot.  El terreno se dibuja una sola vez con sombreado de
+relieve (la altitud no cambia) y en cada instantánea solo se pinta la lava
+encima, con un color según su temperatura.
+
+Las filas de la imagen se pintan en paralelo y el PNG se comprime por
+bandas de filas también en paralelo: cada banda es un bloque deflate
+independiente que termina alineado a byte, así que basta concatenarlas y
+combinar sus sumas Adler-32.
+
+Las animaciones (APNG o Y4M) se escriben cuadro por cuadro en un solo
+archivo mientras corre la simulación, sin guardar cada imagen aparte.
+*/
+
+#include "scalaf.h"
+#include "math.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// tamaño máximo de la imagen, el mismo de las imágenes de gnuplot
+#define ancho_imagen 1366
+#define alto_imagen 720
+
+// cuadros por segundo de las animaciones
+#define cuadros_segundo 5
+
+// grosor de lava, en metros, desde el que la lava se pinta opaca
+#define grosor_opaco 1.0
+
+// Rampa de color de la lava: rojo oscuro frío, naranja, amarillo y blanco
+// a la temperatura de erupción.  t va de 0 a 1.
+static void colorLava(double t, unsigned char rgb[3]) {
+  double r, g, b;
+  if (t < 0) {
+    t = 0;
+  }
+  if (t > 1) {
+    t = 1;
+  }
+  r = 0.35 + 0.65 * fmin(1.0, 2.0 * t);
+  g = fmax(0.0, fmin(1.0, 2.0 * t - 0.5));
+  b = fmax(0.0, 4.0 * t - 3.0);
+  rgb[0] = (unsigned char)(255 * r);
+  rgb[1] = (unsigned char)(255 * g);
+  rgb[2] = (unsigned char)(255 * b);
+}
+
+// Crea el rasterizador para la matriz agrandada del terreno.  La imagen
+// conserva la proporción del mapa y cabe en ancho_imagen x alto_imagen sin
+// ser más grande que el mapa.  Devuelve 0 si no hay memoria.
+int crearRasterizador(rasterizador *R, const mapGrid *terreno,
+                      double anchoCelda, double temperaturaMaxima) {
+  int filas = terreno->filas - 2, columnas = terreno->columnas - 2;
+  int C = terreno->columnas;
+  double escala = fmin(1.0, fmin((double)ancho_imagen / columnas,
+                                 (double)alto_imagen / filas));
+  double minimo = INFINITY, maximo = -INFINITY;
+  int x, y, i, j;
+  R->ancho = (int)(columnas * escala);
+  R->alto = (int)(filas * escala);
+  if (R->ancho < 1) {
+    R->ancho = 1;
+  }
+  if (R->alto < 1) {
+    R->alto = 1;
+  }
+  R->temperaturaMaxima = temperaturaMaxima;
+  R->celdaFila = (int *)malloc(R->alto * sizeof(int));
+  R->celdaColumna = (int *)malloc(R->ancho * sizeof(int));
+  R->fondo = (unsigned char *)malloc((size_t)R->ancho * R->alto * 3);
+  if (!(R->celdaFila && R->celdaColumna && R->fondo)) {
+    liberarRasterizador(R);
+    return 0;
+  }
+  // celda de la matriz agrandada que le corresponde a cada pixel
+  for (y = 0; y < R->alto; y++) {
+    R->celdaFila[y] = 1 + (int)((y + 0.5) * filas / R->alto);
+  }
+  for (x = 0; x < R->ancho; x++) {
+    R->celdaColumna[x] = 1 + (int)((x + 0.5) * columnas / R->ancho);
+  }
+  for (i = 1; i <= filas; i++) {
+    for (j = 1; j <= columnas; j++) {
+      minimo = fmin(minimo, terreno->altitude[i * C + j]);
+      maximo = fmax(maximo, terreno->altitude[i * C + j]);
+    }
+  }
+  // relieve sombreado con la luz desde el noroeste a 45 grados, sobre una
+  // rampa de verde (bajo) a marrón claro (alto)
+#pragma omp parallel for private(x) schedule(static)
+  for (y = 0; y < R->alto; y++) {
+    for (x = 0; x < R->ancho; x++) {
+      int ci = R->celdaFila[y], cj = R->celdaColumna[x];
+      // vecinas interiores, en los bordes se repite la celda
+      int n = (ci > 1) ? ci - 1 : ci, s = (ci < filas) ? ci + 1 : ci;
+      int o = (cj > 1) ? cj - 1 : cj, e = (cj < columnas) ? cj + 1 : cj;
+      double dzdx = (terreno->altitude[ci * C + e] -
+                     terreno->altitude[ci * C + o]) /
+                    ((e - o) * anchoCelda + 1e-12);
+      double dzdy = (terreno->altitude[s * C + cj] -
+                     terreno->altitude[n * C + cj]) /
+                    ((s - n) * anchoCelda + 1e-12);
+      double pendiente = atan(sqrt(dzdx * dzdx + dzdy * dzdy));
+      double orientacion = atan2(dzdy, -dzdx);
+      double sombra = cos(M_PI / 4) * cos(pendiente) +
+                      sin(M_PI / 4) * sin(pendiente) *
+                          cos(3 * M_PI / 4 - orientacion);
+      double h = (maximo > minimo)
+                     ? (terreno->altitude[ci * C + cj] - minimo) /
+                           (maximo - minimo)
+                     : 0.5;
+      double luz = 0.35 + 0.65 * fmax(0.0, sombra);
+      unsigned char *p = R->fondo + ((size_t)y * R->ancho + x) * 3;
+      p[0] = (unsigned char)(255 * luz * (0.45 + 0.35 * h));
+      p[1] = (unsigned char)(255 * luz * (0.55 + 0.15 * h));
+      p[2] = (unsigned char)(255 * luz * (0.35 + 0.25 * h));
+    }
+  }
+  return 1;
+}
+
+void liberarRasterizador(rasterizador *R) {
+  free(R->celdaFila);
+  free(R->celdaColumna);
+  free(R->fondo);
+  R->celdaFila = R->celdaColumna = NULL;
+  R->fondo = NULL;
+}
+
+static void escribirEntero32(unsigned char *p, unsigned long v) {
+  p[0] = (v >> 24) & 0xff;
+  p[1] = (v >> 16) & 0xff;
+  p[2] = (v >> 8) & 0xff;
+  p[3] = v & 0xff;
+}
+
+// Escribe un bloque (chunk) PNG con su largo y su CRC.
+static int escribirBloquePNG(FILE *archivo, const char *tipo,
+                             const unsigned char *datos, size_t largo) {
+  unsigned char numero[4];
+  unsigned long crc = crc32(0L, (const Bytef *)tipo, 4);
+  if (largo > 0) {
+    crc = crc32(crc, datos, largo);
+  }
+  escribirEntero32(numero, largo);
+  if (fwrite(numero, 1, 4, archivo) != 4 || fwrite(tipo, 1, 4, archivo) != 4 ||
+      (largo > 0 && fwrite(datos, 1, largo, archivo) != largo)) {
+    return 0;
+  }
+  escribirEntero32(numero, crc);
+  return fwrite(numero, 1, 4, archivo) == 4;
+}
+
+// Pinta la fila y de la instantánea del grosor y la temperatura de la
+// matriz agrandada A sobre el fondo, en rgb.
+static void pintarFila(const rasterizador *R, const mapGrid *A, int y,
+                       unsigned char *rgb) {
+  const unsigned char *fondo = R->fondo + (size_t)y * R->ancho * 3;
+  size_t base = (size_t)R->celdaFila[y] * A->columnas;
+  int x, c;
+  memcpy(rgb, fondo, (size_t)R->ancho * 3);
+  for (x = 0; x < R->ancho; x++) {
+    size_t k = base + R->celdaColumna[x];
+    if (A->thickness[k] > 1e-8) {
+      unsigned char lava[3];
+      double alfa = 0.4 + 0.6 * fmin(1.0, A->thickness[k] / grosor_opaco);
+      colorLava((A->temperature[k] - 273.0) / (R->temperaturaMaxima - 273.0),
+                lava);
+      for (c = 0; c < 3; c++) {
+        rgb[3 * x + c] =
+            (unsigned char)(alfa * lava[c] + (1 - alfa) * rgb[3 * x + c]);
+      }
+    }
+  }
+}
+
+// Pinta la instantánea de A y la comprime como un flujo zlib con las filas
+// de la imagen PNG.  El flujo empieza en el byte 4 del arreglo que se
+// devuelve, para poder anteponerle el número de secuencia de un bloque fdAT;
+// *largo incluye esos 4 bytes.  Devuelve NULL si no hay memoria.
+static unsigned char *comprimirImagen(const rasterizador *R, const mapGrid *A,
+                                      size_t *largo) {
+  size_t bytesFila = 1 + (size_t)R->ancho * 3;
+  size_t bytesImagen = bytesFila * R->alto, total;
+  unsigned char *filtrada = (unsigned char *)malloc(bytesImagen);
+  unsigned char **comprimida, *flujo = NULL;
+  size_t *largos;
+  unsigned long *adler, suma;
+  int bandas = 1, b, y, ok = 1;
+#ifdef _OPENMP
+  bandas = omp_get_max_threads();
+#endif
+  if (bandas > R->alto) {
+    bandas = R->alto;
+  }
+  comprimida = (unsigned char **)calloc(bandas, sizeof(unsigned char *));
+  largos = (size_t *)calloc(bandas, sizeof(size_t));
+  adler = (unsigned long *)calloc(bandas, sizeof(unsigned long));
+  if (!(filtrada && comprimida && largos && adler)) {
+    free(filtrada);
+    free(comprimida);
+    free(largos);
+    free(adler);
+    return NULL;
+  }
+
+  // pintar cada fila y aplicarle el filtro Sub de PNG, de atrás hacia
+  // adelante para hacerlo en el mismo lugar
+#pragma omp parallel for schedule(static)
+  for (y = 0; y < R->alto; y++) {
+    unsigned char *fila = filtrada + y * bytesFila;
+    size_t i;
+    pintarFila(R, A, y, fila + 1);
+    for (i = bytesFila - 1; i > 3; i--) {
+      fila[i] -= fila[i - 3];
+    }
+    fila[0] = 1;
+  }
+
+  // comprimir las bandas de filas, cada una como bloques deflate sueltos
+#pragma omp parallel for schedule(static, 1)
+  for (b = 0; b < bandas; b++) {
+    size_t inicio = bytesFila * ((size_t)R->alto * b / bandas);
+    size_t fin = bytesFila * ((size_t)R->alto * (b + 1) / bandas);
+    z_stream z;
+    uLong cota;
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, Z_BEST_SPEED, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+      continue;
+    }
+    cota = deflateBound(&z, fin - inicio) + 16;
+    comprimida[b] = (unsigned char *)malloc(cota);
+    if (comprimida[b] != NULL) {
+      z.next_in = filtrada + inicio;
+      z.avail_in = fin - inicio;
+      z.next_out = comprimida[b];
+      z.avail_out = cota;
+      if (deflate(&z, (b == bandas - 1) ? Z_FINISH : Z_SYNC_FLUSH) ==
+          Z_STREAM_ERROR) {
+        free(comprimida[b]);
+        comprimida[b] = NULL;
+      } else {
+        largos[b] = cota - z.avail_out;
+      }
+      adler[b] = adler32(1L, filtrada + inicio, fin - inicio);
+    }
+    deflateEnd(&z);
+  }
+
+  // juntar las bandas entre el encabezado zlib y la suma Adler-32
+  total = 4 + 2 + 4;
+  for (b = 0; b < bandas && ok; b++) {
+    ok = comprimida[b] != NULL;
+    total += largos[b];
+  }
+  if (ok) {
+    flujo = (unsigned char *)malloc(total);
+  }
+  if (flujo != NULL) {
+    size_t p = 4;
+    suma = adler[0];
+    for (b = 1; b < bandas; b++) {
+      size_t inicio = bytesFila * ((size_t)R->alto * b / bandas);
+      size_t fin = bytesFila * ((size_t)R->alto * (b + 1) / bandas);
+      suma = adler32_combine(suma, adler[b], fin - inicio);
+    }
+    flujo[p++] = 0x78; // deflate con ventana de 32 KB
+    flujo[p++] = 0x01;
+    for (b = 0; b < bandas; b++) {
+      memcpy(flujo + p, comprimida[b], largos[b]);
+      p += largos[b];
+    }
+    escribirEntero32(flujo + p, suma);
+    *largo = total;
+  }
+  for (b = 0; b < bandas; b++) {
+    free(comprimida[b]);
+  }
+  free(comprimida);
+  free(largos);
+  free(adler);
+  free(filtrada);
+  return flujo;
+}
+
+// Escribe la firma y el encabezado IHDR de una imagen PNG RGB.
+static int escribirEncabezadoPNG(FILE *archivo, const rasterizador *R) {
+  static const unsigned char firma[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+  unsigned char enca[13];
+  escribirEntero32(enca, R->ancho);
+  escribirEntero32(enca + 4, R->alto);
+  enca[8] = 8;  // bits por canal
+  enca[9] = 2;  // RGB
+  enca[10] = 0; // deflate
+  enca[11] = 0; // filtros de PNG
+  enca[12] = 0; // sin entrelazado
+  return fwrite(firma, 1, 8, archivo) == 8 &&
+         escribirBloquePNG(archivo, "IHDR", enca, 13);
+}
+
+// Pinta la instantánea del grosor y la temperatura de la matriz agrandada A
+// y la guarda como PNG en path.  Devuelve 0 si hay un error.
+int escribirImagenPNG(const rasterizador *R, const mapGrid *A,
+                      const char *path) {
+  size_t largo;
+  unsigned char *flujo = comprimirImagen(R, A, &largo);
+  FILE *archivo;
+  int ok;
+  if (flujo == NULL) {
+    return 0;
+  }
+  archivo = fopen(path, "wb");
+  ok = archivo != NULL && escribirEncabezadoPNG(archivo, R) &&
+       escribirBloquePNG(archivo, "IDAT", flujo + 4, largo - 4) &&
+       escribirBloquePNG(archivo, "IEND", NULL, 0);
+  if (archivo != NULL) {
+    ok = (fclose(archivo) == 0) && ok;
+  }
+  free(flujo);
+  return ok;
+}
+
+// Bloque acTL de una animación APNG con cuadros cuadros que se repite sin
+// fin.
+static int escribirControlAPNG(FILE *archivo, int cuadros) {
+  unsigned char control[8];
+  escribirEntero32(control, cuadros);
+  escribirEntero32(control + 4, 0);
+  return escribirBloquePNG(archivo, "acTL", control, 8);
+}
+
+// Abre en path una animación en formato (formato_apng o formato_y4m) con
+// las imágenes de R, a cuadros_segundo cuadros por segundo.  Los cuadros se
+// agregan uno por uno con agregarCuadro y ninguno se guarda como imagen
+// aparte.  Devuelve 0 si no se pudo crear el archivo.
+int abrirAnimacion(animacion *V, const rasterizador *R, const char *path,
+                   int formato) {
+  int ok;
+  memset(V, 0, sizeof(*V));
+  V->formato = formato;
+  V->archivo = fopen(path, "wb");
+  if (V->archivo == NULL) {
+    return 0;
+  }
+  if (formato == formato_apng) {
+    // el total de cuadros se corrige al cerrar
+    ok = escribirEncabezadoPNG(V->archivo, R);
+    V->posicionControl = ftell(V->archivo);
+    ok = ok && escribirControlAPNG(V->archivo, 0);
+  } else {
+    ok = fprintf(V->archivo, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+                 R->ancho, R->alto, cuadros_segundo) > 0;
+  }
+  if (!ok) {
+    fclose(V->archivo);
+    V->archivo = NULL;
+  }
+  return ok;
+}
+
+// Cuadro APNG: un bloque fcTL y la imagen en IDAT (el primero) o fdAT.
+static int agregarCuadroAPNG(animacion *V, const rasterizador *R,
+                             const mapGrid *A) {
+  unsigned char control[26] = {0};
+  size_t largo;
+  unsigned char *flujo = comprimirImagen(R, A, &largo);
+  int ok;
+  if (flujo == NULL) {
+    return 0;
+  }
+  escribirEntero32(control, V->secuencia++);
+  escribirEntero32(control + 4, R->ancho);
+  escribirEntero32(control + 8, R->alto);
+  // desplazamiento 0, 0; duración 1/cuadros_segundo; sin disposición ni
+  // mezcla, cada cuadro reemplaza al anterior
+  control[20] = 0;
+  control[21] = 1;
+  control[22] = 0;
+  control[23] = cuadros_segundo;
+  ok = escribirBloquePNG(V->archivo, "fcTL", control, 26);
+  if (V->cuadros == 0) {
+    ok = ok && escribirBloquePNG(V->archivo, "IDAT", flujo + 4, largo - 4);
+  } else {
+    escribirEntero32(flujo, V->secuencia++);
+    ok = ok && escribirBloquePNG(V->archivo, "fdAT", flujo, largo);
+  }
+  free(flujo);
+  return ok;
+}
+
+// Cuadro Y4M: los planos Y, Cb y Cr completos (BT.601, rango limitado).
+static int agregarCuadroY4M(animacion *V, const rasterizador *R,
+                            const mapGrid *A) {
+  size_t pixeles = (size_t)R->ancho * R->alto;
+  unsigned char *planos = (unsigned char *)malloc(3 * pixeles);
+  unsigned char *rgb = (unsigned char *)malloc((size_t)R->ancho * 3 *
+                                               R->alto);
+  int y, ok;
+  if (!(planos && rgb)) {
+    free(planos);
+    free(rgb);
+    return 0;
+  }
+#pragma omp parallel for schedule(static)
+  for (y = 0; y < R->alto; y++) {
+    unsigned char *p = rgb + (size_t)y * R->ancho * 3;
+    int x;
+    pintarFila(R, A, y, p);
+    for (x = 0; x < R->ancho; x++) {
+      size_t k = (size_t)y * R->ancho + x;
+      double r = p[3 * x], g = p[3 * x + 1], b = p[3 * x + 2];
+      planos[k] = (unsigned char)(16.5 + 0.257 * r + 0.504 * g + 0.098 * b);
+      planos[pixeles + k] =
+          (unsigned char)(128.5 - 0.148 * r - 0.291 * g + 0.439 * b);
+      planos[2 * pixeles + k] =
+          (unsigned char)(128.5 + 0.439 * r - 0.368 * g - 0.071 * b);
+    }
+  }
+  ok = fputs("FRAME\n", V->archivo) >= 0 &&
+       fwrite(planos, 1, 3 * pixeles, V->archivo) == 3 * pixeles;
+  free(planos);
+  free(rgb);
+  return ok;
+}
+
+// Pinta la instantánea de la matriz agrandada A y la agrega como el
+// siguiente cuadro de la animación.  Devuelve 0 si hay un error; un cuadro
+// a medio escribir deja el archivo inservible (en APNG quedarían un IDAT de
+// más o números de secuencia salteados), así que la animación se cierra
+// ahí y ya no se agregan cuadros.
+int agregarCuadro(animacion *V, const rasterizador *R, const mapGrid *A) {
+  int ok;
+  if (V->archivo == NULL) {
+    return 0;
+  }
+  ok = (V->formato == formato_apng) ? agregarCuadroAPNG(V, R, A)
+                                    : agregarCuadroY4M(V, R, A);
+  if (!ok) {
+    fclose(V->archivo);
+    V->archivo = NULL;
+    V->cuadros = -1; // no se vuelve a abrir
+    return 0;
+  }
+  V->cuadros++;
+  return 1;
+}
+
+// Cierra la animación.  En APNG se escribe el total de cuadros en acTL y
+// el bloque IEND.  Devuelve 0 si hay un error.
+int cerrarAnimacion(animacion *V) {
+  int ok = 1;
+  if (V->archivo == NULL) {
+    return 1;
+  }
+  if (V->formato == formato_apng) {
+    ok = escribirBloquePNG(V->archivo, "IEND", NULL, 0) &&
+         fseek(V->archivo, V->posicionControl, SEEK_SET) == 0 &&
+         escribirControlAPNG(V->archivo, V->cuadros);
+  }
+  ok = (fclose(V->archivo) == 0) && ok;
+  V->archivo = NULL;
+  return ok;
+}
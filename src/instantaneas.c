@@ -0,0 +1,218 @@
+/*
+Escritor de instantáneas en segundo plano.  El proceso 0 reúne el grosor y
+la temperatura en un marco de una cola de marcos reservados al inicio, y un
+hilo aparte los escribe (archivos de gnuplot y la imagen) mientras la
+simulación sigue con los siguientes pasos.
+
+Las instantáneas se escriben en el formato de texto de gnuplot, en el
+binario de instantaneas_bin.c o como imágenes PNG de imagen.c; las dos
+últimas se nombran como las de texto con la extensión .scf o .png.  Con
+formato_apng y formato_y4m todas las instantáneas van como cuadros de una
+sola animación, etiqueta_animacion.png o etiqueta_animacion.y4m.
+
+Si todos los marcos están ocupados, el paso de la simulación espera a que
+se libere uno (bloquear) o se salta esa instantánea (descartar).  Con 0
+marcos las instantáneas se escriben en el mismo hilo, como antes.
+*/
+
+#include "scalaf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Escribe la instantánea del marco m.  La altitud viene del terreno, que no
+// cambia durante la simulación.
+static void escribirMarco(escritorInstantaneas *E, marcoInstantanea *m) {
+  mapGrid vista = *E->terreno;
+  char nombre[1100];
+  vista.thickness = m->thickness;
+  vista.temperature = m->temperature;
+  if (E->formato == formato_gnuplot) {
+    prepararVisualizacionGNUPlot_2(m->secuencia, m->path, vista.filas,
+                                   vista.columnas, &vista, 3, c0.cellWidth, 0,
+                                   0);
+    return;
+  }
+  if (E->formato == formato_apng || E->formato == formato_y4m) {
+    // la animación se abre con la primera instantánea, que trae el path
+    if (E->video.archivo == NULL && E->video.cuadros == 0) {
+      snprintf(nombre, sizeof(nombre), "%sanimacion.%s", m->path,
+               (E->formato == formato_apng) ? "png" : "y4m");
+      printf("Escribiendo animación: %s\n", nombre);
+      if (!abrirAnimacion(&E->video, &E->imagen, nombre, E->formato)) {
+        printf("***\nError al intentar escribir el archivo %s.\n***\n\n",
+               nombre);
+        E->video.cuadros = -1; // no se vuelve a intentar
+      }
+    }
+    if (E->video.archivo != NULL) {
+      printf("Agregando el paso %d a la animación\n", m->secuencia);
+      if (!agregarCuadro(&E->video, &E->imagen, &vista)) {
+        printf("***\nError al agregar el paso %d a la animación, ya no se "
+               "agregan más pasos.\n***\n\n",
+               m->secuencia);
+      }
+    }
+    return;
+  }
+  snprintf(nombre, sizeof(nombre), "%s%d.%s", m->path, m->secuencia,
+           (E->formato == formato_png) ? "png" : "scf");
+  printf("Escribiendo archivo: %s\n", nombre);
+  if (E->formato == formato_png) {
+    if (!escribirImagenPNG(&E->imagen, &vista, nombre)) {
+      printf("***\nError al intentar escribir el archivo %s.\n***\n\n",
+             nombre);
+    }
+  } else if (!escribirInstantaneaBinaria(
+          nombre, &vista, m->secuencia,
+          (E->formato == formato_binario32) ? sizeof(float) : sizeof(double),
+          E->dispersas ? &E->previo : NULL)) {
+    printf("***\nError al intentar escribir el archivo %s.\n***\n\n", nombre);
+  }
+}
+
+// Hilo escritor: toma los marcos en el orden en el que se entregaron.
+static void *hiloEscritor(void *arg) {
+  escritorInstantaneas *E = (escritorInstantaneas *)arg;
+  pthread_mutex_lock(&E->cerrojo);
+  for (;;) {
+    while (E->ocupados == 0 && !E->terminar) {
+      pthread_cond_wait(&E->hayMarco, &E->cerrojo);
+    }
+    if (E->ocupados == 0) {
+      break;
+    }
+    pthread_mutex_unlock(&E->cerrojo);
+    escribirMarco(E, &E->marcos[E->primero]);
+    pthread_mutex_lock(&E->cerrojo);
+    E->primero = (E->primero + 1) % E->numMarcos;
+    E->ocupados--;
+    pthread_cond_signal(&E->hayLibre);
+  }
+  pthread_mutex_unlock(&E->cerrojo);
+  return NULL;
+}
+
+// Crea el escritor con numMarcos marcos para instantáneas del terreno (la
+// matriz agrandada), en el formato dado.  Devuelve 0 si no hay memoria o no
+// se pudo crear el hilo.
+int iniciarEscritor(escritorInstantaneas *E, const mapGrid *terreno,
+                    int numMarcos, int descartar, int formato, int dispersas) {
+  size_t n = (size_t)terreno->filas * terreno->columnas;
+  int m, total = (numMarcos > 0) ? numMarcos : 1;
+  memset(E, 0, sizeof(*E));
+  E->terreno = terreno;
+  E->numMarcos = total;
+  E->descartar = descartar;
+  E->formato = formato;
+  E->dispersas = dispersas && formato != formato_gnuplot;
+  E->enHilo = numMarcos > 0;
+  E->marcos = (marcoInstantanea *)calloc(total, sizeof(marcoInstantanea));
+  if (E->marcos == NULL) {
+    return 0;
+  }
+  if ((E->dispersas && !crearEstadoInstantanea(&E->previo,
+                                               terreno->filas - 2,
+                                               terreno->columnas - 2)) ||
+      ((formato == formato_png || formato == formato_apng ||
+        formato == formato_y4m) &&
+       !crearRasterizador(&E->imagen, terreno, c0.cellWidth,
+                          (c0.eruptionTemperature > 273.0)
+                              ? c0.eruptionTemperature
+                              : 1500.0))) {
+    E->enHilo = 0;
+    terminarEscritor(E);
+    return 0;
+  }
+  for (m = 0; m < total; m++) {
+    // como las mallas, fuera de memoria con -x
+    E->marcos[m].thickness = (real *)reservarArreglo(n * sizeof(real));
+    E->marcos[m].temperature = (real *)reservarArreglo(n * sizeof(real));
+    if (!(E->marcos[m].thickness && E->marcos[m].temperature)) {
+      E->enHilo = 0;
+      terminarEscritor(E);
+      return 0;
+    }
+  }
+  if (E->enHilo) {
+    pthread_mutex_init(&E->cerrojo, NULL);
+    pthread_cond_init(&E->hayMarco, NULL);
+    pthread_cond_init(&E->hayLibre, NULL);
+    if (pthread_create(&E->hilo, NULL, hiloEscritor, E) != 0) {
+      pthread_mutex_destroy(&E->cerrojo);
+      pthread_cond_destroy(&E->hayMarco);
+      pthread_cond_destroy(&E->hayLibre);
+      E->enHilo = 0;
+    }
+  }
+  return 1;
+}
+
+// Marco libre donde reunir la siguiente instantánea, o NULL si la cola
+// está llena y se descartan instantáneas.  Con bloquear espera a que el
+// hilo escritor libere un marco.
+marcoInstantanea *pedirMarco(escritorInstantaneas *E) {
+  marcoInstantanea *m;
+  if (!E->enHilo) {
+    return E->marcos;
+  }
+  pthread_mutex_lock(&E->cerrojo);
+  if (E->ocupados == E->numMarcos && E->descartar) {
+    E->descartadas++;
+    pthread_mutex_unlock(&E->cerrojo);
+    return NULL;
+  }
+  while (E->ocupados == E->numMarcos) {
+    pthread_cond_wait(&E->hayLibre, &E->cerrojo);
+  }
+  m = &E->marcos[(E->primero + E->ocupados) % E->numMarcos];
+  pthread_mutex_unlock(&E->cerrojo);
+  return m;
+}
+
+// Entrega al hilo escritor el marco que dio pedirMarco, ya con los datos
+// del paso secuencia, para escribirlo con el nombre base path.
+void entregarMarco(escritorInstantaneas *E, marcoInstantanea *m,
+                   int secuencia, const char *path) {
+  m->secuencia = secuencia;
+  strncpy(m->path, path, sizeof(m->path) - 1);
+  m->path[sizeof(m->path) - 1] = '\0';
+  if (!E->enHilo) {
+    escribirMarco(E, m);
+    return;
+  }
+  pthread_mutex_lock(&E->cerrojo);
+  E->ocupados++;
+  pthread_cond_signal(&E->hayMarco);
+  pthread_mutex_unlock(&E->cerrojo);
+}
+
+// Espera a que se escriban las instantáneas pendientes y libera el
+// escritor.  Devuelve el número de instantáneas descartadas.
+int terminarEscritor(escritorInstantaneas *E) {
+  int m;
+  if (E->enHilo) {
+    pthread_mutex_lock(&E->cerrojo);
+    E->terminar = 1;
+    pthread_cond_signal(&E->hayMarco);
+    pthread_mutex_unlock(&E->cerrojo);
+    pthread_join(E->hilo, NULL);
+    pthread_mutex_destroy(&E->cerrojo);
+    pthread_cond_destroy(&E->hayMarco);
+    pthread_cond_destroy(&E->hayLibre);
+    E->enHilo = 0;
+  }
+  for (m = 0; m < E->numMarcos && E->marcos; m++) {
+    liberarArreglo(E->marcos[m].thickness);
+    liberarArreglo(E->marcos[m].temperature);
+  }
+  free(E->marcos);
+  E->marcos = NULL;
+  if (!cerrarAnimacion(&E->video)) {
+    printf("***\nError al terminar la animación.\n***\n\n");
+  }
+  liberarEstadoInstantanea(&E->previo);
+  liberarRasterizador(&E->imagen);
+  E->numMarcos = 0;
+  return E->descartadas;
+}
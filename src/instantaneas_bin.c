@@ -0,0 +1,272 @@
+/*
+Formato binario de las instantáneas.  Cada instantánea guarda solo el
+grosor y la temperatura de las celdas interiores; la altitud no cambia y se
+guarda una sola vez como terreno binario (ver terreno.c).
+
+Cada archivo tiene un encabezado de 64 bytes:
+
+  bytes  0..7   "SCALAFI1"
+  bytes  8..11  filas (int32)
+  bytes 12..15  columnas (int32)
+  bytes 16..19  paso de tiempo de la instantánea (int32)
+  bytes 20..23  bytes por valor, 4 (float) o 8 (double) (int32)
+  bytes 24..27  codificación, 0 completa o 1 dispersa (int32)
+  bytes 28..31  paso de la instantánea anterior si es dispersa, o -1 (int32)
+  bytes 32..39  celdas guardadas (int64)
+  bytes 40..63  ceros
+
+Una instantánea completa trae después el grosor de todas las celdas, fila
+por fila, y luego la temperatura.  Una dispersa solo trae las celdas que
+cambiaron desde la instantánea anterior: sus índices (uint32, fila *
+columnas + columna), luego su grosor y luego su temperatura.  Para leer una
+dispersa hay que haber leído antes la anterior.
+*/
+
+#include "scalaf.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char magiaInstantanea[8] = {'S', 'C', 'A', 'L',
+                                         'A', 'F', 'I', '1'};
+
+int crearEstadoInstantanea(estadoInstantanea *S, int filas, int columnas) {
+  size_t n = (size_t)filas * columnas;
+  S->filas = filas;
+  S->columnas = columnas;
+  S->secuencia = -1;
+  S->thickness = (double *)reservarArreglo(n * sizeof(double));
+  S->temperature = (double *)reservarArreglo(n * sizeof(double));
+  if (!(S->thickness && S->temperature)) {
+    liberarEstadoInstantanea(S);
+    return 0;
+  }
+  return 1;
+}
+
+void liberarEstadoInstantanea(estadoInstantanea *S) {
+  liberarArreglo(S->thickness);
+  liberarArreglo(S->temperature);
+  S->thickness = S->temperature = NULL;
+}
+
+// Valor v tal como queda guardado con bytesValor bytes.
+static inline double valorGuardado(double v, int bytesValor) {
+  return (bytesValor == sizeof(float)) ? (double)(float)v : v;
+}
+
+// Escribe n valores en float o double.
+static int escribirValores(FILE *archivo, const double *v, size_t n,
+                           int bytesValor) {
+  float bloque[1024];
+  size_t k, b;
+  if (bytesValor == sizeof(double)) {
+    return fwrite(v, sizeof(double), n, archivo) == n;
+  }
+  for (k = 0; k < n; k += b) {
+    b = (n - k < 1024) ? n - k : 1024;
+    for (size_t l = 0; l < b; l++) {
+      bloque[l] = (float)v[k + l];
+    }
+    if (fwrite(bloque, sizeof(float), b, archivo) != b) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Lee n valores en float o double.
+static int leerValores(FILE *archivo, double *v, size_t n, int bytesValor) {
+  float bloque[1024];
+  size_t k, b;
+  if (bytesValor == sizeof(double)) {
+    return fread(v, sizeof(double), n, archivo) == n;
+  }
+  for (k = 0; k < n; k += b) {
+    b = (n - k < 1024) ? n - k : 1024;
+    if (fread(bloque, sizeof(float), b, archivo) != b) {
+      return 0;
+    }
+    for (size_t l = 0; l < b; l++) {
+      v[k + l] = bloque[l];
+    }
+  }
+  return 1;
+}
+
+// Llena el encabezado de una instantánea en enca, de
+// bytes_encabezado_instantanea bytes.
+void encabezadoInstantanea(unsigned char *enca, int filas, int columnas,
+                           int secuencia, int bytesValor, int dispersa,
+                           int anterior, long long celdas) {
+  int64_t c = celdas;
+  memset(enca, 0, bytes_encabezado_instantanea);
+  memcpy(enca, magiaInstantanea, sizeof(magiaInstantanea));
+  memcpy(enca + 8, &filas, sizeof(int));
+  memcpy(enca + 12, &columnas, sizeof(int));
+  memcpy(enca + 16, &secuencia, sizeof(int));
+  memcpy(enca + 20, &bytesValor, sizeof(int));
+  memcpy(enca + 24, &dispersa, sizeof(int));
+  memcpy(enca + 28, &anterior, sizeof(int));
+  memcpy(enca + 32, &c, sizeof(int64_t));
+}
+
+static int escribirEncabezado(FILE *archivo, int filas, int columnas,
+                              int secuencia, int bytesValor, int dispersa,
+                              int anterior, int64_t celdas) {
+  unsigned char enca[bytes_encabezado_instantanea];
+  encabezadoInstantanea(enca, filas, columnas, secuencia, bytesValor,
+                        dispersa, anterior, celdas);
+  return fwrite(enca, 1, sizeof(enca), archivo) == sizeof(enca);
+}
+
+// Escribe la instantánea del paso secuencia con el grosor y la temperatura
+// de las celdas interiores de la matriz agrandada A.  Si previo no es NULL
+// guarda los valores escritos y, si ya tiene una instantánea, se escriben
+// solo las celdas que cambiaron (o completa si cambiaron tantas que ocupa
+// menos).  Devuelve 0 si hay un error.
+int escribirInstantaneaBinaria(const char *path, const mapGrid *A,
+                               int secuencia, int bytesValor,
+                               estadoInstantanea *previo) {
+  int filas = A->filas - 2, columnas = A->columnas - 2;
+  size_t n = (size_t)filas * columnas, k, cambios = 0;
+  int i, j, ok, dispersa = 0;
+  uint32_t *indices = NULL;
+  double *grosor, *temperatura;
+  FILE *archivo;
+
+  grosor = (double *)reservarArreglo(n * sizeof(double));
+  temperatura = (double *)reservarArreglo(n * sizeof(double));
+  if (!(grosor && temperatura)) {
+    liberarArreglo(grosor);
+    liberarArreglo(temperatura);
+    return 0;
+  }
+  for (i = 0; i < filas; i++) {
+    for (j = 0; j < columnas; j++) {
+      size_t a = (size_t)(i + 1) * A->columnas + j + 1;
+      grosor[(size_t)i * columnas + j] =
+          valorGuardado(A->thickness[a], bytesValor);
+      temperatura[(size_t)i * columnas + j] =
+          valorGuardado(A->temperature[a], bytesValor);
+    }
+  }
+  if (previo != NULL && previo->secuencia >= 0 && n <= UINT32_MAX) {
+    // celdas que cambiaron, comparando los valores ya redondeados para que
+    // la reconstrucción sea igual a la instantánea completa
+    for (k = 0; k < n; k++) {
+      cambios += (grosor[k] != previo->thickness[k] ||
+                  temperatura[k] != previo->temperature[k]);
+    }
+    dispersa = cambios * (sizeof(uint32_t) + 2 * bytesValor) <
+               n * 2 * bytesValor;
+  }
+  if (dispersa) {
+    indices = (uint32_t *)malloc((cambios ? cambios : 1) * sizeof(uint32_t));
+    dispersa = (indices != NULL);
+  }
+  if (dispersa) {
+    // se compactan los valores que cambiaron al inicio de los arreglos
+    size_t c = 0;
+    for (k = 0; k < n; k++) {
+      if (grosor[k] != previo->thickness[k] ||
+          temperatura[k] != previo->temperature[k]) {
+        previo->thickness[k] = grosor[k];
+        previo->temperature[k] = temperatura[k];
+        indices[c] = k;
+        grosor[c] = grosor[k];
+        temperatura[c] = temperatura[k];
+        c++;
+      }
+    }
+  } else if (previo != NULL) {
+    memcpy(previo->thickness, grosor, n * sizeof(double));
+    memcpy(previo->temperature, temperatura, n * sizeof(double));
+  }
+
+  archivo = fopen(path, "wb");
+  ok = archivo != NULL;
+  if (ok) {
+    size_t celdas = dispersa ? cambios : n;
+    ok = escribirEncabezado(archivo, filas, columnas, secuencia, bytesValor,
+                            dispersa, dispersa ? previo->secuencia : -1,
+                            celdas);
+    if (dispersa) {
+      ok = ok && fwrite(indices, sizeof(uint32_t), celdas, archivo) == celdas;
+    }
+    ok = ok && escribirValores(archivo, grosor, celdas, bytesValor);
+    ok = ok && escribirValores(archivo, temperatura, celdas, bytesValor);
+    ok = (fclose(archivo) == 0) && ok;
+  }
+  if (previo != NULL) {
+    // si no se pudo escribir, la siguiente no puede depender de esta
+    previo->secuencia = ok ? secuencia : -1;
+  }
+  free(indices);
+  liberarArreglo(grosor);
+  liberarArreglo(temperatura);
+  return ok;
+}
+
+// Lee una instantánea binaria en S.  Si S no está creado (empieza en cero)
+// se crea con las dimensiones del archivo.  Una instantánea dispersa se
+// aplica sobre la anterior, que debe ser la última leída en S.  Devuelve 0
+// si hay un error.
+int leerInstantaneaBinaria(const char *path, estadoInstantanea *S) {
+  unsigned char enca[bytes_encabezado_instantanea];
+  int filas, columnas, secuencia, bytesValor, dispersa, anterior, ok;
+  int64_t celdas;
+  FILE *archivo = fopen(path, "rb");
+  if (archivo == NULL) {
+    return 0;
+  }
+  if (fread(enca, 1, sizeof(enca), archivo) != sizeof(enca) ||
+      memcmp(enca, magiaInstantanea, sizeof(magiaInstantanea)) != 0) {
+    fclose(archivo);
+    return 0;
+  }
+  memcpy(&filas, enca + 8, sizeof(int));
+  memcpy(&columnas, enca + 12, sizeof(int));
+  memcpy(&secuencia, enca + 16, sizeof(int));
+  memcpy(&bytesValor, enca + 20, sizeof(int));
+  memcpy(&dispersa, enca + 24, sizeof(int));
+  memcpy(&anterior, enca + 28, sizeof(int));
+  memcpy(&celdas, enca + 32, sizeof(int64_t));
+  if (S->thickness == NULL && !crearEstadoInstantanea(S, filas, columnas)) {
+    fclose(archivo);
+    return 0;
+  }
+  ok = filas == S->filas && columnas == S->columnas &&
+       (bytesValor == sizeof(float) || bytesValor == sizeof(double)) &&
+       celdas >= 0 && (size_t)celdas <= (size_t)filas * columnas;
+  if (ok && dispersa) {
+    uint32_t *indices = (uint32_t *)malloc((celdas ? celdas : 1) *
+                                           sizeof(uint32_t));
+    double *valores = (double *)malloc((celdas ? celdas : 1) *
+                                       sizeof(double));
+    int64_t k;
+    ok = indices && valores && S->secuencia == anterior &&
+         fread(indices, sizeof(uint32_t), celdas, archivo) == (size_t)celdas;
+    for (k = 0; ok && k < celdas; k++) {
+      ok = indices[k] < (size_t)filas * columnas;
+    }
+    ok = ok && leerValores(archivo, valores, celdas, bytesValor);
+    for (k = 0; ok && k < celdas; k++) {
+      S->thickness[indices[k]] = valores[k];
+    }
+    ok = ok && leerValores(archivo, valores, celdas, bytesValor);
+    for (k = 0; ok && k < celdas; k++) {
+      S->temperature[indices[k]] = valores[k];
+    }
+    free(indices);
+    free(valores);
+  } else if (ok) {
+    ok = celdas == (int64_t)filas * columnas &&
+         leerValores(archivo, S->thickness, celdas, bytesValor) &&
+         leerValores(archivo, S->temperature, celdas, bytesValor);
+  }
+  fclose(archivo);
+  S->secuencia = ok ? secuencia : -1;
+  return ok;
+}
@@ -0,0 +1,84 @@
+/*
+Instantáneas binarias escritas por todos los procesos con MPI-IO.  Con -o
+cada proceso escribe las filas propias de su franja directamente en un
+solo archivo compartido, con MPI_File_write_at_all, en lugar de reunir las
+franjas en el proceso 0 y escribirlas desde ahí.  El archivo es una
+instantánea completa del formato de instantaneas_bin.c, con los valores en
+el tipo real de la malla (double, o float con PRECISION=simple).
+
+Los datos se escriben sin copiarlos: un tipo derivado describe las celdas
+interiores de las filas propias dentro de la franja (sin las filas
+fantasma ni las columnas de los bordes) y otro el lugar de esas filas en
+cada campo del archivo.  Los tipos dependen de las fronteras de la franja,
+que el balance puede mover, así que se crean en cada escritura.
+*/
+
+#include "scalaf.h"
+
+// Tipos de las celdas interiores de las filas propias de la franja F: en
+// memoria, dentro de un campo de la franja, y en el archivo, dentro de un
+// campo del mapa sin agrandar.
+static void tiposInterior(const franjaLocal *F, MPI_Datatype *memoria,
+                          MPI_Datatype *archivo) {
+  int local[2] = {F->celdas.filas, F->columnas};
+  int mapa[2] = {F->filas, F->columnas - 2};
+  int propias[2] = {F->filasPropias, F->columnas - 2};
+  int enLocal[2] = {filas_halo, 1};
+  int enMapa[2] = {F->filaInicio - 1, 0};
+  MPI_Type_create_subarray(2, local, propias, enLocal, MPI_ORDER_C, mpi_real,
+                           memoria);
+  MPI_Type_create_subarray(2, mapa, propias, enMapa, MPI_ORDER_C, mpi_real,
+                           archivo);
+  MPI_Type_commit(memoria);
+  MPI_Type_commit(archivo);
+}
+
+// Escribe el grosor y la temperatura de la franja F como la instantánea
+// completa del paso secuencia en path.  Todos los procesos deben llamarla.
+// Devuelve 0 si la escritura falló en algún proceso.
+int escribirInstantaneaColectiva(const char *path, const franjaLocal *F,
+                                 int secuencia) {
+  unsigned char enca[bytes_encabezado_instantanea];
+  MPI_Offset n = (MPI_Offset)F->filas * (F->columnas - 2);
+  MPI_Offset campo = n * sizeof(real);
+  const real *campos[2] = {F->celdas.thickness, F->celdas.temperature};
+  MPI_Datatype memoria, archivo;
+  MPI_File fh;
+  int c, ok;
+
+  ok = MPI_File_open(MPI_COMM_WORLD, path, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                     MPI_INFO_NULL, &fh) == MPI_SUCCESS;
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if (!ok) {
+    if (F->rank == 0) {
+      printf("***\nError al intentar escribir el archivo %s.\n***\n", path);
+    }
+    return 0;
+  }
+  tiposInterior(F, &memoria, &archivo);
+  // un archivo anterior con el mismo nombre puede ser más largo
+  ok = MPI_File_set_size(fh, bytes_encabezado_instantanea + 2 * campo) ==
+       MPI_SUCCESS;
+  encabezadoInstantanea(enca, F->filas, F->columnas - 2, secuencia,
+                        sizeof(real), 0, -1, n);
+  ok = MPI_File_write_at_all(fh, 0, enca, (F->rank == 0) ? sizeof(enca) : 0,
+                             MPI_BYTE, MPI_STATUS_IGNORE) == MPI_SUCCESS &&
+       ok;
+  for (c = 0; c < 2; c++) {
+    ok = MPI_File_set_view(fh, bytes_encabezado_instantanea + c * campo,
+                           mpi_real, archivo, "native",
+                           MPI_INFO_NULL) == MPI_SUCCESS &&
+         ok;
+    ok = MPI_File_write_at_all(fh, 0, campos[c], 1, memoria,
+                               MPI_STATUS_IGNORE) == MPI_SUCCESS &&
+         ok;
+  }
+  ok = (MPI_File_close(&fh) == MPI_SUCCESS) && ok;
+  MPI_Type_free(&memoria);
+  MPI_Type_free(&archivo);
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if (!ok && F->rank == 0) {
+    printf("***\nError al intentar escribir el archivo %s.\n***\n", path);
+  }
+  return ok;
+}
@@ -0,0 +1,242 @@
+/*
+Malla del mapa como estructura de arreglos.
+
+Fuera de memoria (-x directorio): para mapas más grandes que la RAM, cada
+arreglo grande de las mallas se guarda en su propio archivo en el
+directorio, mapeado en memoria con mmap.  Los archivos se borran apenas se
+crean, así que desaparecen al terminar el programa aunque termine mal.  El
+sistema operativo deja en RAM solo las páginas que se usan y, cuando falta
+memoria, devuelve al archivo las que llevan más tiempo sin usarse: como el
+mapa de actividad solo calcula los tiles con lava y sus vecinos, lo que
+queda en RAM es el frente de la lava y las filas fantasma.  El terreno seco
+solo se lee al repartir el mapa, al calcular las distancias y al escribir
+las instantáneas.
+
+Las páginas de un tile lejos de la lava tardan en leerse del disco, así que
+cuando un tile se vuelve vivo actualizarActividad pide por adelantado
+(anticiparCeldas) las páginas de los tiles a dos tiles de distancia, que el
+frente alcanza cuando mucho un tile después.  Una página tiene las celdas de
+varios tiles de la misma fila, así que lo que se guarda y se pide son filas
+de tiles, no tiles sueltos.
+*/
+
+#include "scalaf.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// alineación de cada arreglo, una línea de caché
+#define alineacion_malla 64
+// los arreglos más chicos siempre van en memoria
+#define bytes_minimos_archivo (1 << 20)
+
+// directorio de los archivos de las mallas, vacío si van en memoria
+static char directorioMallas[1024] = "";
+
+// Antes de cada arreglo, en la línea de caché anterior, va lo reservado en
+// bytes y si está en un archivo.  En un archivo el arreglo empieza en la
+// segunda página.
+typedef struct {
+  size_t bytes;
+  int enArchivo;
+} reserva;
+
+// Guarda las mallas que se creen de aquí en adelante en archivos en
+// directorio (NULL para volver a la memoria).  Devuelve 0 si no se puede
+// escribir en el directorio.
+int mallasEnArchivos(const char *directorio) {
+  if (directorio == NULL) {
+    directorioMallas[0] = '\0';
+    return 1;
+  }
+  if (strlen(directorio) >= sizeof(directorioMallas) - 16 ||
+      access(directorio, W_OK | X_OK) != 0) {
+    return 0;
+  }
+  strcpy(directorioMallas, directorio);
+  return 1;
+}
+
+// Reserva un arreglo de bytes en un archivo nuevo del directorio de las
+// mallas.  Devuelve NULL si no se pudo.
+static void *reservarEnArchivo(size_t bytes) {
+  size_t pagina = sysconf(_SC_PAGESIZE), largo = pagina + bytes;
+  char nombre[1040];
+  void *p;
+  int fd;
+  snprintf(nombre, sizeof(nombre), "%s/scalaf_XXXXXX", directorioMallas);
+  fd = mkstemp(nombre);
+  if (fd < 0) {
+    return NULL;
+  }
+  unlink(nombre);
+  // el archivo queda disperso: las páginas que no se escriben no ocupan
+  // disco
+  if (ftruncate(fd, largo) != 0) {
+    close(fd);
+    return NULL;
+  }
+  p = mmap(NULL, largo, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+  p = (char *)p + pagina;
+  ((reserva *)((char *)p - alineacion_malla))->bytes = largo;
+  ((reserva *)((char *)p - alineacion_malla))->enArchivo = 1;
+  return p;
+}
+
+// Reserva un arreglo alineado, en un archivo si las mallas van fuera de
+// memoria y es grande.  Devuelve NULL si no hay memoria.
+void *reservarArreglo(size_t bytes) {
+  void *p = NULL;
+  if (directorioMallas[0] != '\0' && bytes >= bytes_minimos_archivo) {
+    return reservarEnArchivo(bytes);
+  }
+  if (posix_memalign(&p, alineacion_malla, alineacion_malla + bytes) != 0) {
+    return NULL;
+  }
+  ((reserva *)p)->bytes = bytes;
+  ((reserva *)p)->enArchivo = 0;
+  return (char *)p + alineacion_malla;
+}
+
+void liberarArreglo(void *p) {
+  reserva *r;
+  if (p == NULL) {
+    return;
+  }
+  r = (reserva *)((char *)p - alineacion_malla);
+  if (r->enArchivo) {
+    munmap((char *)p - sysconf(_SC_PAGESIZE), r->bytes);
+  } else {
+    free(r);
+  }
+}
+
+// Crea una malla de filas x columnas.  Los valores de las celdas quedan sin
+// inicializar.  Devuelve 0 si no hay memoria suficiente.
+int crearMalla(mapGrid *M, int filas, int columnas) {
+  size_t n = (size_t)filas * columnas;
+  M->filas = filas;
+  M->columnas = columnas;
+  M->altitude = (real *)reservarArreglo(n * sizeof(real));
+  M->thickness = (real *)reservarArreglo(n * sizeof(real));
+  M->temperature = (real *)reservarArreglo(n * sizeof(real));
+  M->yield = (real *)reservarArreglo(n * sizeof(real));
+  M->viscosity = (real *)reservarArreglo(n * sizeof(real));
+  M->inboundV = (real *)reservarArreglo(n * sizeof(real));
+  M->outboundV = (real *)reservarArreglo(n * sizeof(real));
+  M->inboundQ = (double *)reservarArreglo(n * sizeof(double));
+  M->exits = (short *)reservarArreglo(n * sizeof(short));
+  M->isVent = (char *)reservarArreglo(n * sizeof(char));
+  M->distancia = NULL;
+  if (!(M->altitude && M->thickness && M->temperature && M->yield &&
+        M->viscosity && M->inboundV && M->outboundV && M->inboundQ &&
+        M->exits && M->isVent)) {
+    liberarMalla(M);
+    return 0;
+  }
+  return 1;
+}
+
+// Reserva la tabla de distancias a las vecinas de la malla M, sin calcular.
+// Devuelve 0 si no hay memoria.
+int crearDistancias(mapGrid *M) {
+  size_t n = (size_t)M->filas * M->columnas;
+  liberarArreglo(M->distancia);
+  M->distancia = (real *)reservarArreglo(4 * n * sizeof(real));
+  return M->distancia != NULL;
+}
+
+void liberarMalla(mapGrid *M) {
+  liberarArreglo(M->altitude);
+  liberarArreglo(M->thickness);
+  liberarArreglo(M->temperature);
+  liberarArreglo(M->yield);
+  liberarArreglo(M->viscosity);
+  liberarArreglo(M->inboundV);
+  liberarArreglo(M->outboundV);
+  liberarArreglo(M->inboundQ);
+  liberarArreglo(M->exits);
+  liberarArreglo(M->isVent);
+  liberarArreglo(M->distancia);
+  M->altitude = M->thickness = M->temperature = NULL;
+  M->yield = M->viscosity = NULL;
+  M->inboundV = M->outboundV = NULL;
+  M->inboundQ = NULL;
+  M->exits = NULL;
+  M->isVent = NULL;
+  M->distancia = NULL;
+}
+
+// Arreglos de la malla M con su tamaño en bytes por celda, en el orden de
+// mapGrid (sin las distancias, que se calculan de la altitud).  Devuelve
+// cuántos son; campos y bytes deben tener lugar para 10.
+int camposMalla(const mapGrid *M, void **campos, size_t *bytes) {
+  void *c[] = {M->altitude,  M->thickness, M->temperature, M->yield,
+               M->viscosity, M->inboundV,  M->outboundV,   M->inboundQ,
+               M->exits,     M->isVent};
+  size_t b[] = {sizeof(real), sizeof(real),   sizeof(real),  sizeof(real),
+                sizeof(real), sizeof(real),   sizeof(real),  sizeof(double),
+                sizeof(short), sizeof(char)};
+  memcpy(campos, c, sizeof(c));
+  memcpy(bytes, b, sizeof(b));
+  return 10;
+}
+
+// Pide al sistema, sin esperar, las páginas de largo bytes desde p.
+static void pedirPaginas(char *p, size_t largo) {
+  size_t pagina = sysconf(_SC_PAGESIZE);
+  char *inicio = (char *)((uintptr_t)p & ~(uintptr_t)(pagina - 1));
+  madvise(inicio, p + largo - inicio, MADV_WILLNEED);
+}
+
+// Pide por adelantado las páginas de las celdas [i0, i1) x [j0, j1) de
+// todos los arreglos de la malla M (recortadas a la malla), si las mallas
+// están fuera de memoria.
+void anticiparCeldas(const mapGrid *M, int i0, int i1, int j0, int j1) {
+  void *campos[10];
+  size_t bytes[10], n = (size_t)M->filas * M->columnas;
+  int c, i, numCampos;
+  if (directorioMallas[0] == '\0') {
+    return;
+  }
+  i0 = (i0 < 0) ? 0 : i0;
+  i1 = (i1 > M->filas) ? M->filas : i1;
+  j0 = (j0 < 0) ? 0 : j0;
+  j1 = (j1 > M->columnas) ? M->columnas : j1;
+  if (i0 >= i1 || j0 >= j1) {
+    return;
+  }
+  numCampos = camposMalla(M, campos, bytes);
+  for (i = i0; i < i1; i++) {
+    size_t k = (size_t)i * M->columnas + j0;
+    for (c = 0; c < numCampos; c++) {
+      pedirPaginas((char *)campos[c] + k * bytes[c], (j1 - j0) * bytes[c]);
+    }
+    for (c = 0; c < 4 && M->distancia != NULL; c++) {
+      pedirPaginas((char *)(M->distancia + c * n + k),
+                   (j1 - j0) * sizeof(real));
+    }
+  }
+}
+
+// Valores de las celdas extras de los bordes: altitud muy grande, más que la
+// del everest, grosor de capa 0 y temperatura 0.
+void celdaBorde(mapGrid *M, int k) {
+  M->altitude[k] = 100000;
+  M->thickness[k] = 0;
+  M->temperature[k] = 0;
+  M->isVent[k] = 0;
+  M->yield[k] = 0;
+  M->viscosity[k] = 0;
+  M->exits[k] = 0;
+  M->inboundV[k] = 0;
+  M->outboundV[k] = 0;
+  M->inboundQ[k] = 0;
+}
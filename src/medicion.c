@@ -0,0 +1,327 @@
+/*
+Medición del paso de tiempo.  Con -i archivo cada proceso toma el tiempo de
+cada fase de cada paso (reología, salidas y flujos, consolidación, espera
+del halo, mapa de actividad, reunir e instantáneas, puntos de reinicio y
+balance de las franjas), cuenta las celdas calculadas y, con -j, lee
+contadores del procesador (ciclos, instrucciones y fallos de la caché de
+último nivel) con perf_event_open.  Al final el proceso 0 junta los
+registros de todos los procesos y escribe un reporte con una fila por
+proceso y paso, en JSON si el archivo termina en .json y si no en CSV.  Las
+salidas se calculan en la misma pasada que los flujos, así que van en una
+sola fase, salidas_flujos.
+
+Sin -i, marcaFase y sumarFase solo revisan una bandera.
+
+Los contadores se abren en cada hilo de OpenMP, así que cuentan el cálculo
+de todos los hilos del proceso; si el sistema no los permite (por ejemplo
+con perf_event_paranoid alto) el reporte los deja en -1.
+*/
+
+#include "scalaf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+medicionPasos medicion;
+
+static const char *nombresFases[num_fases] = {
+    "reologia", "salidas_flujos", "consolidacion", "halo",    "actividad",
+    "reunir",   "instantaneas",   "reinicio",      "balance"};
+static const char *nombresContadores[num_contadores] = {
+    "ciclos", "instrucciones", "fallos_llc"};
+
+#ifdef __linux__
+// Abre un contador del hilo que llama, o devuelve -1.
+static int abrirContador(unsigned int tipo, unsigned long long configuracion) {
+  struct perf_event_attr a;
+  memset(&a, 0, sizeof(a));
+  a.size = sizeof(a);
+  a.type = tipo;
+  a.config = configuracion;
+  a.exclude_kernel = 1;
+  a.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &a, 0, -1, -1, 0);
+}
+#endif
+
+// Abre los contadores de cada hilo.  Devuelve 0 si alguno no se pudo abrir.
+static int abrirContadores(void) {
+  int hilos = 1, ok = 1, h, c;
+#ifdef _OPENMP
+  hilos = omp_get_max_threads();
+#endif
+  medicion.hilos = hilos;
+  medicion.contadores = (int *)malloc(hilos * num_contadores * sizeof(int));
+  if (medicion.contadores == NULL) {
+    return 0;
+  }
+  for (h = 0; h < hilos * num_contadores; h++) {
+    medicion.contadores[h] = -1;
+  }
+#ifdef __linux__
+#pragma omp parallel num_threads(hilos) private(c) reduction(&& : ok)
+  {
+    int *fd = medicion.contadores;
+#ifdef _OPENMP
+    fd += omp_get_thread_num() * num_contadores;
+#endif
+    fd[0] = abrirContador(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fd[1] = abrirContador(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fd[2] = abrirContador(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    for (c = 0; c < num_contadores; c++) {
+      ok = ok && fd[c] >= 0;
+    }
+  }
+#else
+  ok = 0;
+#endif
+  (void)c;
+  return ok;
+}
+
+// Suma de cada contador en todos los hilos, o -1 si no está abierto.
+static void leerContadores(long long *valores) {
+  int h, c;
+  for (c = 0; c < num_contadores; c++) {
+    valores[c] = -1;
+    for (h = 0; h < medicion.hilos && medicion.contadores; h++) {
+      long long v;
+      int fd = medicion.contadores[h * num_contadores + c];
+      if (fd >= 0 && read(fd, &v, sizeof(v)) == sizeof(v)) {
+        valores[c] = (valores[c] < 0) ? v : valores[c] + v;
+      }
+    }
+  }
+}
+
+// Activa la medición para pasos pasos, con contadores del procesador si
+// contadores es 1.  Debe llamarse antes de la primera región paralela, así
+// los contadores se abren en los hilos que hacen el cálculo.  Devuelve 0 si
+// no hay memoria.
+int iniciarMedicion(int pasos, int contadores) {
+  memset(&medicion, 0, sizeof(medicion));
+  medicion.registros =
+      (registroPaso *)calloc(pasos > 0 ? pasos : 1, sizeof(registroPaso));
+  if (medicion.registros == NULL) {
+    return 0;
+  }
+  medicion.capacidad = pasos;
+  if (contadores && !abrirContadores()) {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (rank == 0) {
+      printf("\nAVISO: no se pudieron abrir los contadores del procesador "
+             "(perf_event_open), se reportan como -1.\n");
+    }
+  }
+  medicion.activa = 1;
+  return 1;
+}
+
+double marcaFase(void) { return medicion.activa ? MPI_Wtime() : 0.0; }
+
+void sumarFase(int fase, double inicio) {
+  if (medicion.activa) {
+    medicion.actual.fase[fase] += MPI_Wtime() - inicio;
+  }
+}
+
+// Empieza el registro del paso paso de la franja F: cuenta las celdas
+// propias que se van a calcular, las de los tramos activos.
+void empezarPaso(int paso, const franjaLocal *F) {
+  long long celdas = 0;
+  int i;
+  if (!medicion.activa) {
+    return;
+  }
+  memset(&medicion.actual, 0, sizeof(medicion.actual));
+  medicion.actual.paso = paso;
+  for (i = filas_halo; i < filas_halo + F->filasPropias; i++) {
+    int j0, j1 = 0;
+    while (siguienteTramo(F, i, &j0, &j1)) {
+      celdas += j1 - j0;
+    }
+  }
+  medicion.actual.celdas = celdas;
+  leerContadores(medicion.inicioContadores);
+  medicion.inicioPaso = MPI_Wtime();
+}
+
+// Termina el registro del paso actual.
+void terminarPaso(void) {
+  long long valores[num_contadores];
+  int c;
+  registroPaso *r;
+  if (!medicion.activa) {
+    return;
+  }
+  medicion.actual.total = MPI_Wtime() - medicion.inicioPaso;
+  leerContadores(valores);
+  for (c = 0; c < num_contadores; c++) {
+    medicion.actual.contador[c] =
+        (valores[c] < 0 || medicion.inicioContadores[c] < 0)
+            ? -1
+            : valores[c] - medicion.inicioContadores[c];
+  }
+  if (medicion.numRegistros == medicion.capacidad) {
+    int capacidad = medicion.capacidad ? 2 * medicion.capacidad : 16;
+    r = (registroPaso *)realloc(medicion.registros,
+                                capacidad * sizeof(registroPaso));
+    if (r == NULL) {
+      return;
+    }
+    medicion.registros = r;
+    medicion.capacidad = capacidad;
+  }
+  medicion.registros[medicion.numRegistros++] = medicion.actual;
+}
+
+static void escribirRegistro(FILE *archivo, int json, int rank,
+                             const registroPaso *r, int primero) {
+  int f, c;
+  double porSegundo = (r->total > 0) ? r->celdas / r->total : 0;
+  if (json) {
+    fprintf(archivo, "%s\n    {\"rank\": %d, \"paso\": %d", primero ? "" : ",",
+            rank, r->paso);
+    for (f = 0; f < num_fases; f++) {
+      fprintf(archivo, ", \"%s\": %.9f", nombresFases[f], r->fase[f]);
+    }
+    fprintf(archivo,
+            ", \"total\": %.9f, \"celdas\": %lld, \"celdas_por_s\": %.1f",
+            r->total, r->celdas, porSegundo);
+    for (c = 0; c < num_contadores; c++) {
+      fprintf(archivo, ", \"%s\": %lld", nombresContadores[c], r->contador[c]);
+    }
+    fprintf(archivo, "}");
+  } else {
+    fprintf(archivo, "%d,%d", rank, r->paso);
+    for (f = 0; f < num_fases; f++) {
+      fprintf(archivo, ",%.9f", r->fase[f]);
+    }
+    fprintf(archivo, ",%.9f,%lld,%.1f", r->total, r->celdas, porSegundo);
+    for (c = 0; c < num_contadores; c++) {
+      fprintf(archivo, ",%lld", r->contador[c]);
+    }
+    fprintf(archivo, "\n");
+  }
+}
+
+// Junta los registros de todos los procesos en el proceso 0, que escribe el
+// reporte en path e imprime un resumen.  Todos los procesos deben llamarla.
+// Devuelve 0 si hubo un error.
+int escribirMedicion(const char *path) {
+  int rank, size, r, k, f, ok = 1, json, maximo;
+  int *cuantos = NULL, *desplazamientos = NULL;
+  registroPaso *todos = NULL;
+  double suma[num_fases] = {0}, total = 0;
+  long long celdas = 0;
+  MPI_Datatype tipoRegistro;
+  FILE *archivo;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  MPI_Type_contiguous(sizeof(registroPaso), MPI_BYTE, &tipoRegistro);
+  MPI_Type_commit(&tipoRegistro);
+  if (rank == 0) {
+    cuantos = (int *)malloc(size * sizeof(int));
+    desplazamientos = (int *)malloc(size * sizeof(int));
+  }
+  MPI_Gather(&medicion.numRegistros, 1, MPI_INT, cuantos, 1, MPI_INT, 0,
+             MPI_COMM_WORLD);
+  if (rank == 0) {
+    desplazamientos[0] = 0;
+    for (r = 1; r < size; r++) {
+      desplazamientos[r] = desplazamientos[r - 1] + cuantos[r - 1];
+    }
+    todos = (registroPaso *)malloc(
+        (desplazamientos[size - 1] + cuantos[size - 1] + 1) *
+        sizeof(registroPaso));
+  }
+  MPI_Gatherv(medicion.registros, medicion.numRegistros, tipoRegistro, todos,
+              cuantos, desplazamientos, tipoRegistro, 0, MPI_COMM_WORLD);
+  MPI_Type_free(&tipoRegistro);
+
+  if (rank == 0) {
+    json = strlen(path) >= 5 && strcmp(path + strlen(path) - 5, ".json") == 0;
+    archivo = fopen(path, "w");
+    ok = archivo != NULL;
+    if (ok && json) {
+      fprintf(archivo, "{\n  \"procesos\": %d,\n  \"pasos\": [", size);
+    } else if (ok) {
+      fprintf(archivo, "rank,paso");
+      for (f = 0; f < num_fases; f++) {
+        fprintf(archivo, ",%s", nombresFases[f]);
+      }
+      fprintf(archivo, ",total,celdas,celdas_por_s");
+      for (f = 0; f < num_contadores; f++) {
+        fprintf(archivo, ",%s", nombresContadores[f]);
+      }
+      fprintf(archivo, "\n");
+    }
+    for (r = 0; r < size; r++) {
+      for (k = 0; k < cuantos[r]; k++) {
+        const registroPaso *p = &todos[desplazamientos[r] + k];
+        if (ok) {
+          escribirRegistro(archivo, json, r, p, r == 0 && k == 0);
+        }
+        for (f = 0; f < num_fases; f++) {
+          suma[f] += p->fase[f];
+        }
+        celdas += p->celdas;
+      }
+    }
+    if (ok) {
+      if (json) {
+        fprintf(archivo, "\n  ]\n}\n");
+      }
+      ok = (fclose(archivo) == 0) && ok;
+    }
+    // resumen: el tiempo del paso es el del proceso más lento
+    maximo = 0;
+    for (r = 0; r < size; r++) {
+      maximo = (cuantos[r] > maximo) ? cuantos[r] : maximo;
+    }
+    for (k = 0; k < maximo; k++) {
+      double lento = 0;
+      for (r = 0; r < size; r++) {
+        if (k < cuantos[r] && todos[desplazamientos[r] + k].total > lento) {
+          lento = todos[desplazamientos[r] + k].total;
+        }
+      }
+      total += lento;
+    }
+    printf("\nMedición de %d pasos en %d procesos (%s):\n", maximo, size,
+           path);
+    for (f = 0; f < num_fases; f++) {
+      printf("  %-14s %10.4f s\n", nombresFases[f], suma[f] / size);
+    }
+    printf("  %-14s %10.4f s, %.2f Mceldas/s\n", "total", total,
+           (total > 0) ? celdas / total / 1e6 : 0);
+    free(cuantos);
+    free(desplazamientos);
+    free(todos);
+  }
+  return ok;
+}
+
+// Cierra los contadores y libera los registros.
+void terminarMedicion(void) {
+  int h;
+  for (h = 0; medicion.contadores && h < medicion.hilos * num_contadores;
+       h++) {
+    if (medicion.contadores[h] >= 0) {
+      close(medicion.contadores[h]);
+    }
+  }
+  free(medicion.contadores);
+  free(medicion.registros);
+  memset(&medicion, 0, sizeof(medicion));
+}
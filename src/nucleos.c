@@ -0,0 +1,237 @@
+/*
+Núcleos de cálculo por fila de FuncionPrincipal: reología, conteo de
+salidas y flujos.  Acá están las versiones escalares y la selección, al
+iniciar, de la versión vectorial que soporta el procesador.
+*/
+
+#include "scalaf.h"
+#include "math.h"
+#include "string.h"
+#include <stdio.h>
+
+// Función que calcula la viscosidad a partir de la temperatura,
+// tomada del artículo de Miyamoto y Sasaki
+double visc(double temperature) {
+  return pow(10, (20.0 * (exp(-0.001835 * (temperature - 273.0)))));
+}
+
+// Función que calcula la tensión cortante a partir de la temperatura,
+// tomada del artículo de Miyamoto y Sasaki
+double yield(double temperature) {
+  return pow(10, (11.67 - 0.0089 * (temperature - 273.0)));
+}
+
+// Calcula la tabla de distancias de la malla A a partir de la altitud, que
+// no cambia durante la simulación.  Las direcciones que salen de la malla
+// quedan en 0, ninguna celda calculada las usa.
+void calcularDistancias(mapGrid *A) {
+  static const int dl[4] = {0, 1, 1, 1}, dm[4] = {1, -1, 0, 1};
+  size_t plano = (size_t)A->filas * A->columnas;
+  int i, C = A->columnas;
+#pragma omp parallel for
+  for (i = 0; i < A->filas; i++) {
+    int j, d;
+    for (d = 0; d < 4; d++) {
+      real *fila = A->distancia + d * plano + (size_t)i * C;
+      for (j = 0; j < C; j++) {
+        int l = i + dl[d], m = j + dm[d];
+        if (l < A->filas && m >= 0 && m < C) {
+          double dA = A->altitude[i * C + j] - A->altitude[l * C + m];
+          fila[j] = sqrt(dA * dA + c0.cellWidth * c0.cellWidth);
+        } else {
+          fila[j] = 0;
+        }
+      }
+    }
+  }
+}
+
+// Grosor crítico para que la lava de la celda n (origen) fluya hacia la
+// celda c (destino), con el esfuerzo de cedencia de la celda de origen y la
+// distancia entre las dos celdas de la tabla.
+static inline double grosorCritico(const mapGrid *A, int n, int c,
+                                   double distancia) {
+  double Acomp = A->altitude[n], Hcomp = A->thickness[n];
+  double Aref = A->altitude[c], Href = A->thickness[c];
+  // alfa = atan((Acomp-Aref)/c0.anchoCelda);
+  return fabs((A->yield[n] * distancia) /
+              (density * gravity * ((Acomp - Aref) - (Hcomp - Href))));
+}
+
+// Revisa si la lava de la celda n puede salir hacia la celda c con el
+// grosor crítico Hcrit: el grosor de n lo supera y la superficie de n está
+// más alta que la de c.
+static inline int haySalida(const mapGrid *A, int n, int c, double Hcrit) {
+  if ((A->thickness[n] > Hcrit) && (Hcrit > 1e-8)) {
+    // aca ya asumi que es plano; las superficies se suman en double para
+    // no perder el grosor contra la altitud si los campos son float
+    return fabs((double)A->thickness[n] + A->altitude[n]) >
+           fabs((double)A->thickness[c] + A->altitude[c]);
+  }
+  return 0;
+}
+
+// Volumen que sale de la celda n hacia la celda c en un paso de tiempo,
+// cuando hay salida con el grosor crítico Hcrit y n tiene salidas salidas.
+// Las celdas de los bordes tienen yield 0 y una altitud mayor que cualquier
+// superficie de lava, así que nunca ceden ni reciben volumen.
+static inline double volumenCedido(const mapGrid *A, int n, int c,
+                                   double Hcrit, short salidas) {
+  double cArea = c0.cellWidth * c0.cellWidth;
+  double deltaV, maxV;
+  double Hcomp = A->thickness[n];
+  double deltaH = Hcomp - A->thickness[c];
+  // como esta operacion se repite es mejor hacerla una sola vez
+  double h_hc = Hcomp / Hcrit;
+  // Hcrit =
+  // ((A[(ni)*(columnas)+(nj)].yield)/((density*gravity)*(sin(alfa)-((Hcomp-Href)/c0.anchoCelda)*cos(alfa))));
+  deltaV = (1.0 / salidas) *
+           ((A->yield[n] * Hcrit * Hcrit * c0.cellWidth) /
+            (3 * (double)A->viscosity[n])) *
+           (h_hc * h_hc * h_hc - 1.5 * h_hc * h_hc + 0.5) * (c0.deltat);
+  maxV = (deltaH * cArea) / (2 * salidas);
+  if (maxV < deltaV) {
+    // luz, fuego, destrucción
+    deltaV = maxV;
+  }
+  return deltaV;
+}
+
+// viscosidad y yield de n celdas consecutivas
+void reologiaEscalar(const real *temperature, real *viscosity,
+                     real *yieldStress, int n) {
+  int j;
+  for (j = 0; j < n; j++) {
+    viscosity[j] = visc(temperature[j]);
+    yieldStress[j] = yield(temperature[j]);
+  }
+}
+
+// Cuenta las salidas de las celdas [j0, j1) de la fila i y calcula el
+// volumen que cada una cede a sus 8 vecinas, cedido[d][j] para la vecina d
+// en el orden (-1,-1), (-1,0), ..., (1,1).  Cada celda revisa sus 8 vecinas
+// una sola vez: el grosor crítico de cada par sirve para la salida y para el
+// volumen.  Las salidas se guardan en exits solo si escribir es 1.
+void salidasEscalar(mapGrid *A, int i, int j0, int j1, double *const *cedido,
+                    int escribir) {
+  int j, l, m, d, columnas = A->columnas;
+  for (j = j0; j < j1; j++) {
+    int c = i * columnas + j;
+    double Hcrit[8];
+    int sale[8];
+    short salidas = 0;
+    d = 0;
+    for (l = -1; l < 2; l++) {
+      for (m = -1; m < 2; m++) {
+        if (!(m == 0 && l == 0)) {
+          int n = c + l * columnas + m;
+          Hcrit[d] = grosorCritico(A, c, n, *distanciaVecina(A, c, l, m));
+          sale[d] = haySalida(A, c, n, Hcrit[d]);
+          salidas += sale[d];
+          d++;
+        }
+      }
+    }
+    if (escribir) {
+      A->exits[c] = salidas;
+    }
+    d = 0;
+    for (l = -1; l < 2; l++) {
+      for (m = -1; m < 2; m++) {
+        if (!(m == 0 && l == 0)) {
+          cedido[d][j] = sale[d] ? volumenCedido(A, c, c + l * columnas + m,
+                                                 Hcrit[d], salidas)
+                                 : 0.0;
+          d++;
+        }
+      }
+    }
+  }
+}
+
+// Flujos de las celdas [j0, j1) de la fila i a partir de los volúmenes
+// cedidos de las filas i - 1, i e i + 1 (cedido[0..7], [8..15] y [16..23]).
+// Lo que la celda recibe de la vecina d es lo que la vecina cede en la
+// dirección opuesta, 7 - d.  Los aportes se suman en el mismo orden en el
+// que el recorrido por filas los sumaba, para obtener los mismos valores que
+// la versión que escribía en la celda vecina.
+void flujosEscalar(mapGrid *A, int i, int j0, int j1,
+                   double *const *cedido) {
+  int j, l, m, d, columnas = A->columnas;
+  double deltaV = 0.0;
+  for (j = j0; j < j1; j++) {
+    int c = i * columnas + j;
+    double inboundV = 0.0, inboundQ = 0.0, outboundV = 0.0;
+    if (A->isVent[c] == 1) {
+      // si hay un crater se aumenta el thickness en un valor igual a la
+      // tasa de erupción sobre el area de la celda por el delta de tiempo
+      deltaV = (c0.eruptionRate) * c0.deltat;
+      inboundV += (deltaV);
+      inboundQ += (deltaV * c0.eruptionTemperature) * heatCapacity * density;
+    }
+    d = 0;
+    for (l = -1; l < 2; l++) {
+      for (m = -1; m < 2; m++) {
+        if (!(m == 0 && l == 0)) {
+          int n = (i + l) * columnas + (j + m);
+          // volumen que entra desde la vecina, con su calor
+          deltaV = cedido[(l + 1) * 8 + 7 - d][j + m];
+          inboundV += (deltaV);
+          inboundQ += deltaV * A->temperature[n] * density * heatCapacity;
+          // volumen que sale hacia la vecina
+          outboundV += cedido[8 + d][j];
+          d++;
+        }
+      }
+    }
+    A->inboundV[c] = inboundV;
+    A->inboundQ[c] = inboundQ;
+    A->outboundV[c] = outboundV;
+  }
+}
+
+// núcleos en uso, por defecto los escalares
+nucleosCalculo nucleos = {"escalar", reologiaEscalar, salidasEscalar,
+                          flujosEscalar};
+
+static const nucleosCalculo nucleosEscalares = {
+    "escalar", reologiaEscalar, salidasEscalar, flujosEscalar};
+// las vectoriales usan la reología escalar (exp y pow de libm), así dan los
+// mismos resultados que la escalar; las "rápidas" usan además la reología
+// vectorial, que no es idéntica (ver nucleos_avx.c) y hay que pedirla
+static const nucleosCalculo nucleosAVX2 = {"avx2", reologiaEscalar,
+                                           salidasAVX2, flujosAVX2};
+static const nucleosCalculo nucleosAVX512 = {"avx512", reologiaEscalar,
+                                             salidasAVX512, flujosAVX512};
+static const nucleosCalculo nucleosAVX2Rapido = {"avx2-rapido", reologiaAVX2,
+                                                 salidasAVX2, flujosAVX2};
+static const nucleosCalculo nucleosAVX512Rapido = {
+    "avx512-rapido", reologiaAVX512, salidasAVX512, flujosAVX512};
+
+// Escoge los núcleos de cálculo.  Con nombre NULL o "auto" se usa la versión
+// exacta más ancha que soporte el procesador; si se pide una que el
+// procesador no soporta se usa la escalar.  Devuelve 0 si el nombre no
+// existe.
+int seleccionarNucleos(const char *nombre) {
+  int avx2, avx512;
+  __builtin_cpu_init();
+  avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  // las versiones AVX-512 terminan las filas con las AVX2
+  avx512 = avx2 && __builtin_cpu_supports("avx512f");
+  if (nombre == NULL || strcmp(nombre, "auto") == 0) {
+    nucleos = avx512 ? nucleosAVX512 : (avx2 ? nucleosAVX2 : nucleosEscalares);
+  } else if (strcmp(nombre, "escalar") == 0) {
+    nucleos = nucleosEscalares;
+  } else if (strcmp(nombre, "avx2") == 0) {
+    nucleos = avx2 ? nucleosAVX2 : nucleosEscalares;
+  } else if (strcmp(nombre, "avx512") == 0) {
+    nucleos = avx512 ? nucleosAVX512 : nucleosEscalares;
+  } else if (strcmp(nombre, "avx2-rapido") == 0) {
+    nucleos = avx2 ? nucleosAVX2Rapido : nucleosEscalares;
+  } else if (strcmp(nombre, "avx512-rapido") == 0) {
+    nucleos = avx512 ? nucleosAVX512Rapido : nucleosEscalares;
+  } else {
+    return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,151 @@
+/*
+Paso de tiempo adaptativo.  Con -T segundos la simulación avanza hasta
+simular esos segundos en lugar de dar un número fijo de pasos (-n queda
+como el máximo de pasos), y el dt de cada paso se escoge al terminar el
+anterior, entre -D (por defecto time_delta) y -M (por defecto
+max_time_delta) segundos.
+
+La señal del flujo es el cambio relativo de grosor: consolidarFlujos guarda
+el mayor |h - h0| / h0 de las celdas que ya tenían lava, y como mientras el
+límite maxV de volumenCedido no corta el flujo el volumen cedido es
+proporcional a dt, el dt con el que ese cambio sería cambio_maximo es
+dt * cambio_maximo / cambio.  La radiación es explícita y con un dt muy
+largo se llevaría más calor del que tiene una celda delgada y caliente, así
+que consolidarFlujos calcula también el dt con el que se lo llevaría todo.
+Como el límite maxV deja salir a lo sumo la mitad de la lava de una celda
+(y con ella la mitad de su calor), con fraccion_radiacion de ese dt a la
+celda le queda al menos un cuarto del calor.  El siguiente dt es
+
+  min(crecimiento * dt anterior, flujo, fraccion_radiacion * radiación,
+      maxDeltat)
+
+sin bajar de minDeltat, salvo por la radiación: su límite se respeta aunque
+quede por debajo de minDeltat, porque si no la celda terminaría con menos
+calor que cero.  Al final se avisa cuántos pasos usaron minDeltat aunque el
+flujo pedía menos, y cuántos bajaron de minDeltat por la radiación.
+
+Mientras la lava avanza el frente cambia de grosor mucho más que
+cambio_maximo por paso y el flujo no deja subir el dt de minDeltat; el dt
+crece cuando la lava se acumula en los cráteres sin superar el grosor
+crítico o ya se detuvo y solo se enfría, que es donde el paso fijo gasta
+pasos sin cambiar nada.  Con las celdas de 1 m del bench las celdas
+delgadas del frente radian todo su calor en menos de un segundo, así que
+ahí la radiación baja el dt de time_delta y -T da más pasos que el paso
+fijo, no menos.
+
+El historial de dt (paso, segundos simulados al final, dt usado, dt del
+flujo y dt de la radiación) lo escribe el proceso 0 en etiqueta_pasos.csv.
+*/
+
+#include "scalaf.h"
+#include <math.h>
+#include <stdlib.h>
+
+// mayor cambio relativo de grosor por paso, fracción del dt de la radiación
+// que se usa y cuánto puede crecer dt en un paso
+#define cambio_maximo 0.1
+#define fraccion_radiacion 0.25
+#define crecimiento_deltat 2.0
+
+int iniciarHistorial(historialPasos *H, int pasos) {
+  size_t n = (pasos > 0) ? pasos : 1;
+  H->numPasos = 0;
+  H->capacidad = pasos;
+  H->enMinimo = H->bajoMinimo = 0;
+  H->paso = (int *)malloc(n * sizeof(int));
+  H->tiempo = (double *)malloc(n * sizeof(double));
+  H->deltat = (double *)malloc(n * sizeof(double));
+  H->flujo = (double *)malloc(n * sizeof(double));
+  H->radiacion = (double *)malloc(n * sizeof(double));
+  if (!(H->paso && H->tiempo && H->deltat && H->flujo && H->radiacion)) {
+    liberarHistorial(H);
+    return 0;
+  }
+  return 1;
+}
+
+void liberarHistorial(historialPasos *H) {
+  free(H->paso);
+  free(H->tiempo);
+  free(H->deltat);
+  free(H->flujo);
+  free(H->radiacion);
+  H->paso = NULL;
+  H->tiempo = H->deltat = H->flujo = H->radiacion = NULL;
+  H->numPasos = H->capacidad = 0;
+}
+
+// Termina el paso paso: suma su dt al tiempo simulado, lo guarda en el
+// historial y escoge el dt del siguiente con los límites de todas las
+// franjas.  Todos los procesos deben llamarla.
+void ajustarDeltat(historialPasos *H, const franjaLocal *F, int paso) {
+  double cambio = F->cambioGrosor, radiacion = F->deltatRadiacion;
+  double flujo, dt;
+  MPI_Allreduce(MPI_IN_PLACE, &cambio, 1, MPI_DOUBLE, MPI_MAX,
+                MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, &radiacion, 1, MPI_DOUBLE, MPI_MIN,
+                MPI_COMM_WORLD);
+  flujo = (cambio > 0) ? c0.deltat * cambio_maximo / cambio : HUGE_VAL;
+  c0.elapsedTime += c0.deltat;
+  if (H->numPasos < H->capacidad) {
+    H->paso[H->numPasos] = paso;
+    H->tiempo[H->numPasos] = c0.elapsedTime;
+    H->deltat[H->numPasos] = c0.deltat;
+    H->flujo[H->numPasos] = flujo;
+    H->radiacion[H->numPasos] = radiacion;
+    H->numPasos++;
+  }
+  dt = crecimiento_deltat * c0.deltat;
+  if (dt > flujo) {
+    dt = flujo;
+  }
+  if (dt > c0.maxDeltat) {
+    dt = c0.maxDeltat;
+  }
+  if (dt < c0.minDeltat) {
+    H->enMinimo += (flujo < c0.minDeltat);
+    dt = c0.minDeltat;
+  }
+  // la radiación manda aunque baje de minDeltat
+  if (dt > fraccion_radiacion * radiacion) {
+    dt = fraccion_radiacion * radiacion;
+    H->bajoMinimo += (dt < c0.minDeltat);
+  }
+  if (dt > c0.targetTime - c0.elapsedTime) {
+    dt = c0.targetTime - c0.elapsedTime;
+  }
+  c0.deltat = dt;
+}
+
+// Revisa si ya se simuló todo el tiempo pedido, con un margen para el
+// redondeo de la suma de los dt.
+int tiempoCumplido(void) {
+  return c0.elapsedTime >= c0.targetTime * (1 - 1e-12);
+}
+
+// Escribe un límite del historial, vacío si es infinito (nada fluyó o no
+// hay lava que radie).
+static int escribirLimite(FILE *archivo, double limite, const char *fin) {
+  return isinf(limite) ? fprintf(archivo, "%s", fin) > 0
+                       : fprintf(archivo, "%.9g%s", limite, fin) > 0;
+}
+
+// Escribe el historial en path, agregando al final si agregar es 1 (al
+// seguir desde un punto de reinicio).  Devuelve 0 si hubo un error.
+int escribirHistorial(const historialPasos *H, const char *path,
+                      int agregar) {
+  FILE *archivo = fopen(path, agregar ? "a" : "w");
+  int k, ok;
+  if (archivo == NULL) {
+    return 0;
+  }
+  ok = agregar ||
+       fprintf(archivo, "paso,tiempo,dt,dt_flujo,dt_radiacion\n") > 0;
+  for (k = 0; k < H->numPasos && ok; k++) {
+    ok = fprintf(archivo, "%d,%.9g,%.9g,", H->paso[k], H->tiempo[k],
+                 H->deltat[k]) > 0 &&
+         escribirLimite(archivo, H->flujo[k], ",") &&
+         escribirLimite(archivo, H->radiacion[k], "\n");
+  }
+  return (fclose(archivo) == 0) && ok;
+}
@@ -0,0 +1,201 @@
+/*
+Mapa de peligro de un conjunto de escenarios.  Durante la simulación se
+acumulan por celda, sin guardar ningún paso:
+
+  - en cuántos miembros del conjunto la celda tuvo lava,
+  - el grosor máximo y la temperatura máxima de la lava,
+  - el primer paso en el que llegó la lava en cualquier miembro.
+
+Al terminar, los mapas de todos los procesos se juntan con reducciones MPI
+(suma, máximo y mínimo) y el proceso 0 escribe un solo archivo:
+
+  bytes  0..7   "SCALAFP1"
+  bytes  8..11  filas (int32)
+  bytes 12..15  columnas (int32)
+  bytes 16..19  miembros del conjunto (int32)
+  bytes 20..23  pasos de cada miembro (int32)
+  bytes 24..31  duración de un paso en segundos (double)
+  bytes 32..63  ceros
+
+y después cuatro mapas float de filas x columnas, fila por fila: la
+probabilidad de que la celda tenga lava (miembros con lava / miembros), el
+grosor máximo, la temperatura máxima y el tiempo de la primera llegada en
+segundos (-1 si la lava nunca llegó).
+
+Una celda tiene lava con el mismo umbral que usa el mapa de actividad.
+*/
+
+#include "scalaf.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char magiaPeligro[8] = {'S', 'C', 'A', 'L', 'A', 'F', 'P', '1'};
+
+int crearMapaPeligro(mapaPeligro *P, int filas, int columnas) {
+  size_t n = (size_t)filas * columnas, k;
+  memset(P, 0, sizeof(*P));
+  P->filas = filas;
+  P->columnas = columnas;
+  P->inundadas = (int *)calloc(n, sizeof(int));
+  P->grosorMaximo = (double *)calloc(n, sizeof(double));
+  P->temperaturaMaxima = (double *)calloc(n, sizeof(double));
+  P->primeraLlegada = (int *)malloc(n * sizeof(int));
+  P->llegada = (int *)malloc(n * sizeof(int));
+  if (!(P->inundadas && P->grosorMaximo && P->temperaturaMaxima &&
+        P->primeraLlegada && P->llegada)) {
+    liberarMapaPeligro(P);
+    return 0;
+  }
+  for (k = 0; k < n; k++) {
+    P->primeraLlegada[k] = INT_MAX;
+  }
+  return 1;
+}
+
+void liberarMapaPeligro(mapaPeligro *P) {
+  free(P->inundadas);
+  free(P->grosorMaximo);
+  free(P->temperaturaMaxima);
+  free(P->primeraLlegada);
+  free(P->llegada);
+  P->inundadas = P->primeraLlegada = P->llegada = NULL;
+  P->grosorMaximo = P->temperaturaMaxima = NULL;
+}
+
+// Empieza un miembro del conjunto: todavía no llega la lava a ninguna celda.
+void iniciarMiembro(mapaPeligro *P) {
+  memset(P->llegada, 0xff, (size_t)P->filas * P->columnas * sizeof(int));
+}
+
+// Acumula el estado de la franja F (un solo proceso, todo el mapa) después
+// del paso paso.  Solo se revisan los tramos activos: la lava solo está en
+// tiles vivos, que siempre son activos.
+void acumularPaso(mapaPeligro *P, const franjaLocal *F, int paso) {
+  const mapGrid *A = &F->celdas;
+  int i, C = F->columnas;
+  int p0 = filas_halo, p1 = filas_halo + F->filasPropias;
+#pragma omp parallel for schedule(dynamic, 4)
+  for (i = p0; i < p1; i++) {
+    // fila del mapa sin agrandar
+    size_t base = (size_t)(i + F->filaInicio - filas_halo - 1) * P->columnas;
+    int j, j0, j1 = 0;
+    while (siguienteTramo(F, i, &j0, &j1)) {
+      for (j = j0; j < j1; j++) {
+        int k = i * C + j;
+        size_t m = base + j - 1;
+        if (A->thickness[k] > 1e-8) {
+          if (P->llegada[m] < 0) {
+            P->llegada[m] = paso;
+          }
+          if (A->thickness[k] > P->grosorMaximo[m]) {
+            P->grosorMaximo[m] = A->thickness[k];
+          }
+          if (A->temperature[k] > P->temperaturaMaxima[m]) {
+            P->temperaturaMaxima[m] = A->temperature[k];
+          }
+        }
+      }
+    }
+  }
+}
+
+// Termina el miembro actual y lo suma a los conteos y llegadas.
+void terminarMiembro(mapaPeligro *P) {
+  size_t n = (size_t)P->filas * P->columnas, k;
+  for (k = 0; k < n; k++) {
+    if (P->llegada[k] >= 0) {
+      P->inundadas[k]++;
+      if (P->llegada[k] < P->primeraLlegada[k]) {
+        P->primeraLlegada[k] = P->llegada[k];
+      }
+    }
+  }
+  P->miembros++;
+}
+
+// Valor float de la celda k en el mapa campo (0 a 3, en el orden del
+// archivo).
+static float valorPeligro(const mapaPeligro *P, int campo, size_t k,
+                          int miembros, double dt) {
+  switch (campo) {
+  case 0:
+    return miembros ? (float)P->inundadas[k] / miembros : 0.0f;
+  case 1:
+    return (float)P->grosorMaximo[k];
+  case 2:
+    return (float)P->temperaturaMaxima[k];
+  default:
+    return (P->primeraLlegada[k] == INT_MAX)
+               ? -1.0f
+               : (float)((P->primeraLlegada[k] + 1) * dt);
+  }
+}
+
+// Escribe el mapa campo como float.
+static int escribirMapa(FILE *archivo, const mapaPeligro *P, int campo,
+                        int miembros, double dt) {
+  float bloque[1024];
+  size_t n = (size_t)P->filas * P->columnas, k, l, b;
+  for (k = 0; k < n; k += b) {
+    b = (n - k < 1024) ? n - k : 1024;
+    for (l = 0; l < b; l++) {
+      bloque[l] = valorPeligro(P, campo, k + l, miembros, dt);
+    }
+    if (fwrite(bloque, sizeof(float), b, archivo) != b) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Junta los mapas de todos los procesos en el proceso 0, que lo escribe en
+// path; pasos es el número de pasos de cada miembro.  Todos los procesos
+// deben llamarla.  Devuelve 0 si hubo un error en el proceso 0.
+int escribirMapaPeligro(mapaPeligro *P, const char *path, int pasos) {
+  size_t n = (size_t)P->filas * P->columnas;
+  unsigned char enca[64] = {0};
+  double dt = c0.deltat;
+  int rank, miembros, campo, ok;
+  FILE *archivo;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Reduce(&P->miembros, &miembros, 1, MPI_INT, MPI_SUM, 0,
+             MPI_COMM_WORLD);
+  if (rank == 0) {
+    MPI_Reduce(MPI_IN_PLACE, P->inundadas, n, MPI_INT, MPI_SUM, 0,
+               MPI_COMM_WORLD);
+    MPI_Reduce(MPI_IN_PLACE, P->grosorMaximo, n, MPI_DOUBLE, MPI_MAX, 0,
+               MPI_COMM_WORLD);
+    MPI_Reduce(MPI_IN_PLACE, P->temperaturaMaxima, n, MPI_DOUBLE, MPI_MAX, 0,
+               MPI_COMM_WORLD);
+    MPI_Reduce(MPI_IN_PLACE, P->primeraLlegada, n, MPI_INT, MPI_MIN, 0,
+               MPI_COMM_WORLD);
+  } else {
+    MPI_Reduce(P->inundadas, NULL, n, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(P->grosorMaximo, NULL, n, MPI_DOUBLE, MPI_MAX, 0,
+               MPI_COMM_WORLD);
+    MPI_Reduce(P->temperaturaMaxima, NULL, n, MPI_DOUBLE, MPI_MAX, 0,
+               MPI_COMM_WORLD);
+    MPI_Reduce(P->primeraLlegada, NULL, n, MPI_INT, MPI_MIN, 0,
+               MPI_COMM_WORLD);
+    return 1;
+  }
+
+  archivo = fopen(path, "wb");
+  if (archivo == NULL) {
+    return 0;
+  }
+  memcpy(enca, magiaPeligro, sizeof(magiaPeligro));
+  memcpy(enca + 8, &P->filas, sizeof(int));
+  memcpy(enca + 12, &P->columnas, sizeof(int));
+  memcpy(enca + 16, &miembros, sizeof(int));
+  memcpy(enca + 20, &pasos, sizeof(int));
+  memcpy(enca + 24, &dt, sizeof(double));
+  ok = fwrite(enca, 1, sizeof(enca), archivo) == sizeof(enca);
+  for (campo = 0; campo < 4 && ok; campo++) {
+    ok = escribirMapa(archivo, P, campo, miembros, dt);
+  }
+  ok = (fclose(archivo) == 0) && ok;
+  return ok;
+}
@@ -0,0 +1,321 @@
+/*
+Puntos de reinicio.  Cada cierto número de pasos cada proceso guarda su
+franja local completa (todos los campos de las celdas, incluidas las filas
+fantasma y los cráteres de isVent), su mapa de actividad, el paso de tiempo
+y las condiciones iniciales c0.  Con eso una simulación que se reinicia
+sigue exactamente igual que si no se hubiera detenido.
+
+Cada proceso escribe su propio archivo en un hilo aparte, a partir de una
+copia de la franja, mientras la simulación continúa.  Los archivos se
+alternan entre dos ranuras, etiqueta_reinicio_<rank>_<ranura>.scr, y cada
+uno se escribe primero con la extensión .tmp y se renombra al terminar: si
+el programa muere a mitad de una escritura queda el punto anterior.  Al
+reiniciar se usa el punto más reciente que tengan todos los procesos; si
+el balance había movido las fronteras de las franjas, las franjas toman
+las fronteras guardadas antes de leerlo.
+
+Encabezado de 128 bytes:
+
+  bytes  0..7   "SCALAFR1"
+  bytes  8..47  size, rank, filaInicio, filaFin, filas de la franja,
+                columnas, paso, filasTiles, columnasTiles, bytes por valor
+                de los campos real (int32)
+  bytes 48..    c0 tal como está en memoria (mismo programa)
+
+Después van los arreglos de la franja en el orden de mapGrid y los mapas
+de actividad vivas y activas.
+*/
+
+#include "scalaf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define bytes_encabezado_reinicio 128
+
+// c0 debe caber en el encabezado después de los datos de la franja
+typedef char c0EnEncabezado[(48 + sizeof(initialConditions) <=
+                             bytes_encabezado_reinicio)
+                                ? 1
+                                : -1];
+
+static const char magiaReinicio[8] = {'S', 'C', 'A', 'L',
+                                      'A', 'F', 'R', '1'};
+
+// Nombre del archivo de la ranura, con extensión .tmp si temporal es 1.
+static void nombreReinicio(char *nombre, size_t largo, const char *base,
+                           int rank, int ranura, int temporal) {
+  snprintf(nombre, largo, "%s_%d_%d.scr%s", base, rank, ranura,
+           temporal ? ".tmp" : "");
+}
+
+static void llenarEncabezado(unsigned char *enca, const escritorReinicio *R) {
+  int datos[10] = {R->size,
+                   R->rank,
+                   R->filaInicio,
+                   R->filaFin,
+                   R->copia.filas,
+                   R->copia.columnas,
+                   R->paso,
+                   R->filasTiles,
+                   R->columnasTiles,
+                   (int)sizeof(real)};
+  memset(enca, 0, bytes_encabezado_reinicio);
+  memcpy(enca, magiaReinicio, sizeof(magiaReinicio));
+  memcpy(enca + 8, datos, sizeof(datos));
+  memcpy(enca + 48, &R->c0, sizeof(initialConditions));
+}
+
+// Hilo que escribe la copia de la franja en la ranura R->ranura.
+static void *hiloReinicio(void *arg) {
+  escritorReinicio *R = (escritorReinicio *)arg;
+  unsigned char enca[bytes_encabezado_reinicio];
+  char temporal[1100], nombre[1100];
+  size_t n = (size_t)R->copia.filas * R->copia.columnas;
+  size_t tiles = (size_t)R->filasTiles * R->columnasTiles;
+  void *campos[10];
+  size_t bytes[10];
+  int c, numCampos = camposMalla(&R->copia, campos, bytes);
+  FILE *archivo;
+
+  nombreReinicio(temporal, sizeof(temporal), R->base, R->rank, R->ranura, 1);
+  nombreReinicio(nombre, sizeof(nombre), R->base, R->rank, R->ranura, 0);
+  llenarEncabezado(enca, R);
+  archivo = fopen(temporal, "wb");
+  R->ok = archivo != NULL;
+  if (R->ok) {
+    R->ok = fwrite(enca, 1, sizeof(enca), archivo) == sizeof(enca);
+    for (c = 0; c < numCampos && R->ok; c++) {
+      R->ok = fwrite(campos[c], bytes[c], n, archivo) == n;
+    }
+    R->ok = R->ok && fwrite(R->vivas, 1, tiles, archivo) == tiles &&
+            fwrite(R->activas, 1, tiles, archivo) == tiles;
+    // el archivo debe estar en disco antes de reemplazar el anterior
+    R->ok = R->ok && fflush(archivo) == 0 && fsync(fileno(archivo)) == 0;
+    R->ok = (fclose(archivo) == 0) && R->ok;
+    R->ok = R->ok && rename(temporal, nombre) == 0;
+  }
+  return NULL;
+}
+
+// Prepara el escritor de puntos de reinicio de la franja F, con archivos
+// base_<rank>_<ranura>.scr.  Devuelve 0 si no hay memoria para la copia.
+int iniciarReinicio(escritorReinicio *R, const franjaLocal *F,
+                    const char *base) {
+  size_t tiles = (size_t)F->filasTiles * F->columnasTiles;
+  memset(R, 0, sizeof(*R));
+  strncpy(R->base, base, sizeof(R->base) - 1);
+  R->rank = F->rank;
+  R->size = F->size;
+  R->filaInicio = F->filaInicio;
+  R->filaFin = F->filaFin;
+  R->filasTiles = F->filasTiles;
+  R->columnasTiles = F->columnasTiles;
+  R->ranura = 1; // la primera escritura va a la ranura 0
+  R->ok = 1;
+  R->vivas = (unsigned char *)malloc(tiles ? tiles : 1);
+  R->activas = (unsigned char *)malloc(tiles ? tiles : 1);
+  if (!(R->vivas && R->activas) ||
+      !crearMalla(&R->copia, F->celdas.filas, F->columnas)) {
+    free(R->vivas);
+    free(R->activas);
+    R->vivas = R->activas = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+// Guarda la franja F como punto de reinicio para seguir en el paso paso.
+// Copia la franja y la escribe en un hilo aparte; solo espera si la
+// escritura anterior no ha terminado.  Devuelve 0 si la escritura anterior
+// falló.
+int guardarReinicio(escritorReinicio *R, const franjaLocal *F, int paso) {
+  size_t n = (size_t)F->celdas.filas * F->columnas;
+  size_t tiles = (size_t)R->filasTiles * R->columnasTiles;
+  void *origen[10], *destino[10];
+  size_t bytes[10];
+  int c, numCampos, anterior;
+  if (R->enCurso) {
+    pthread_join(R->hilo, NULL);
+    R->enCurso = 0;
+  }
+  anterior = R->ok;
+  numCampos = camposMalla(&F->celdas, origen, bytes);
+  camposMalla(&R->copia, destino, bytes);
+  for (c = 0; c < numCampos; c++) {
+    memcpy(destino[c], origen[c], bytes[c] * n);
+  }
+  if (F->activas != NULL) {
+    memcpy(R->vivas, F->vivas, tiles);
+    memcpy(R->activas, F->activas, tiles);
+  } else {
+    R->filasTiles = R->columnasTiles = 0;
+  }
+  R->c0 = c0;
+  R->paso = paso;
+  R->ranura ^= 1;
+  if (pthread_create(&R->hilo, NULL, hiloReinicio, R) == 0) {
+    R->enCurso = 1;
+  } else {
+    hiloReinicio(R);
+  }
+  return anterior;
+}
+
+// Ajusta el escritor a la franja F después de mover sus fronteras, sin
+// cambiar de ranura.  Espera la escritura en curso.  Devuelve 0, con el
+// escritor ya liberado, si no hay memoria para la copia nueva o la
+// escritura anterior falló.
+int ajustarReinicio(escritorReinicio *R, const franjaLocal *F) {
+  escritorReinicio nuevo;
+  int ranura = R->ranura;
+  if (!terminarReinicio(R)) {
+    return 0;
+  }
+  if (!iniciarReinicio(&nuevo, F, R->base)) {
+    return 0;
+  }
+  nuevo.ranura = ranura;
+  *R = nuevo;
+  return 1;
+}
+
+// Espera la última escritura y libera el escritor.  Devuelve 0 si falló.
+int terminarReinicio(escritorReinicio *R) {
+  if (R->enCurso) {
+    pthread_join(R->hilo, NULL);
+    R->enCurso = 0;
+  }
+  liberarMalla(&R->copia);
+  free(R->vivas);
+  free(R->activas);
+  R->vivas = R->activas = NULL;
+  return R->ok;
+}
+
+// Lee el encabezado de la ranura y revisa que sea de esta franja; deja en
+// fronteras la primera fila propia y la siguiente a la última que tenía al
+// guardarse.  Devuelve el paso guardado o -1.
+static int pasoRanura(const franjaLocal *F, const char *base, int ranura,
+                      initialConditions *condiciones, int *fronteras) {
+  unsigned char enca[bytes_encabezado_reinicio];
+  char nombre[1100];
+  int datos[10], ok;
+  FILE *archivo;
+  nombreReinicio(nombre, sizeof(nombre), base, F->rank, ranura, 0);
+  archivo = fopen(nombre, "rb");
+  if (archivo == NULL) {
+    return -1;
+  }
+  ok = fread(enca, 1, sizeof(enca), archivo) == sizeof(enca) &&
+       memcmp(enca, magiaReinicio, sizeof(magiaReinicio)) == 0;
+  fclose(archivo);
+  if (!ok) {
+    return -1;
+  }
+  memcpy(datos, enca + 8, sizeof(datos));
+  memcpy(condiciones, enca + 48, sizeof(initialConditions));
+  fronteras[0] = datos[2];
+  fronteras[1] = datos[3];
+  ok = datos[0] == F->size && datos[1] == F->rank &&
+       datos[4] == datos[3] - datos[2] + 2 * filas_halo &&
+       datos[5] == F->columnas &&
+       datos[9] == sizeof(real) &&
+       condiciones->maxRows == F->filas &&
+       condiciones->maxColumns == F->columnas - 2;
+  return ok ? datos[6] : -1;
+}
+
+// Lee los datos de la ranura en la franja F.
+static int leerRanura(franjaLocal *F, const char *base, int ranura) {
+  unsigned char enca[bytes_encabezado_reinicio];
+  char nombre[1100];
+  size_t n = (size_t)F->celdas.filas * F->columnas, tiles;
+  int datos[10], c, numCampos, ok;
+  void *campos[10];
+  size_t bytes[10];
+  FILE *archivo;
+  nombreReinicio(nombre, sizeof(nombre), base, F->rank, ranura, 0);
+  archivo = fopen(nombre, "rb");
+  if (archivo == NULL) {
+    return 0;
+  }
+  ok = fread(enca, 1, sizeof(enca), archivo) == sizeof(enca);
+  memcpy(datos, enca + 8, sizeof(datos));
+  tiles = (size_t)datos[7] * datos[8];
+  numCampos = camposMalla(&F->celdas, campos, bytes);
+  for (c = 0; c < numCampos && ok; c++) {
+    ok = fread(campos[c], bytes[c], n, archivo) == n;
+  }
+  if (ok && F->activas != NULL && datos[7] == F->filasTiles &&
+      datos[8] == F->columnasTiles) {
+    ok = fread(F->vivas, 1, tiles, archivo) == tiles &&
+         fread(F->activas, 1, tiles, archivo) == tiles;
+  } else if (ok) {
+    // el mapa guardado no sirve para esta franja, se recalcula completo
+    actualizarActividad(F, 1);
+  }
+  fclose(archivo);
+  return ok;
+}
+
+// Carga en la franja F el punto de reinicio más reciente que tengan todos
+// los procesos, con archivos base_<rank>_<ranura>.scr, y restaura c0 (con
+// el dt y el tiempo simulado) salvo el número de pasos, el tiempo por
+// simular y los dt mínimo y máximo, que vienen de los parámetros.  Todos los
+// procesos deben llamarla.  Devuelve el paso en el que sigue la simulación,
+// o -1 si no hay un punto de reinicio completo.
+int leerReinicio(franjaLocal *F, const char *base) {
+  initialConditions condiciones[2];
+  int pasos[2], minimo[2], maximo[2], fronteras[2][2], ranura = -1, r, ok;
+  int *todas, valido, iguales = 1;
+  for (r = 0; r < 2; r++) {
+    pasos[r] = pasoRanura(F, base, r, &condiciones[r], fronteras[r]);
+  }
+  MPI_Allreduce(pasos, minimo, 2, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  MPI_Allreduce(pasos, maximo, 2, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+  // una ranura sirve si todos los procesos tienen el mismo paso en ella
+  for (r = 0; r < 2; r++) {
+    if (minimo[r] >= 0 && minimo[r] == maximo[r] &&
+        (ranura < 0 || minimo[r] > minimo[ranura])) {
+      ranura = r;
+    }
+  }
+  if (ranura < 0) {
+    return -1;
+  }
+  // las fronteras de todas las franjas al guardar la ranura deben cubrir
+  // las filas sin huecos; después quedan solo los inicios, como los pide
+  // moverFranjas
+  todas = (int *)malloc((2 * F->size + 1) * sizeof(int));
+  ok = todas != NULL;
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if (!ok) {
+    free(todas);
+    return -1;
+  }
+  MPI_Allgather(fronteras[ranura], 2, MPI_INT, todas, 2, MPI_INT,
+                MPI_COMM_WORLD);
+  valido = todas[0] == 1 && todas[2 * F->size - 1] == F->filas + 1;
+  for (r = 0; r < F->size; r++) {
+    valido = valido && todas[2 * r + 1] - todas[2 * r] >= filas_halo &&
+             (r == 0 || todas[2 * r] == todas[2 * r - 1]);
+    iguales = iguales && todas[2 * r] == F->desplazamientos[r];
+    todas[r] = todas[2 * r];
+  }
+  todas[F->size] = F->filas + 1;
+  ok = valido && (iguales || moverFranjas(F, todas, 0));
+  free(todas);
+  ok = ok && leerRanura(F, base, ranura);
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if (!ok) {
+    return -1;
+  }
+  condiciones[ranura].timeSteps = c0.timeSteps;
+  condiciones[ranura].targetTime = c0.targetTime;
+  condiciones[ranura].minDeltat = c0.minDeltat;
+  condiciones[ranura].maxDeltat = c0.maxDeltat;
+  c0 = condiciones[ranura];
+  return minimo[ranura];
+}
@@ -11,22 +11,14 @@ Código secuencial para la simulación de flujos de lava volcánica
 #include <stdlib.h>
 #include <unistd.h>
 #include <mpi.h>
-
-// Función que calcula la viscosidad a partir de la temperatura,
-// tomada del artículo de Miyamoto y Sasaki
-double visc(double temperature) {
-  return pow(10, (20.0 * (exp(-0.001835 * (temperature - 273.0)))));
-}
-
-// Función que calcula la tensión cortante a partir de la temperatura,
-// tomada del artículo de Miyamoto y Sasaki
-double yield(double temperature) {
-  return pow(10, (11.67 - 0.0089 * (temperature - 273.0)));
-}
-
-// Función para colocar los cráteres en la matriz,
-// toma los datos de un punto en 2D y revisa que estén en el rango correcto.
-int placeCraters(mapCell *A, const point2D *P, int totalRows, int totalColumns,
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Función para colocar los cráteres en la matriz agrandada, toma los datos
+// de un punto en 2D (fila y columna del mapa sin agrandar) y revisa que
+// estén en el rango correcto.
+int placeCraters(mapGrid *A, const point2D *P, int totalRows, int totalColumns,
                  int totalCraters) {
 
   int craterColumn, craterRow;
@@ -35,7 +27,7 @@ int placeCraters(mapCell *A, const point2D *P, int totalRows, int totalColumns,
     craterColumn = P[i].y;
     if ((craterRow > -1) && (craterRow < totalRows)) {
       if ((craterColumn > -1) && (craterColumn < totalColumns)) {
-        A[craterRow * totalColumns + craterColumn].isVent = 1;
+        A->isVent[(craterRow + 1) * (totalColumns + 2) + craterColumn + 1] = 1;
       }
     }
   }
@@ -71,739 +63,326 @@ int readCratersPositionFile(char *path, int numberOfCraters,
   }
 }
 
-// Función para inicializar los valores en las celdas del terreno,
-// las altitudes del terreno se leen desde un archivo de texto plano
-// y los demás valores en la celda son asignados por defecto.
-int readTerrainFile(char *path, int maxRows, int maxColumns, mapCell *map) {
-  FILE *mapAltitudesFile;
-  char lineBuffer[8192];
-  char *token;
-  int error;
-  int i, j;
-  double altitudeValue;
-
-  if (mapAltitudesFile = fopen(path, "r")) {
-    printf("\nLeyendo mapa de alturas del terreno...");
-    i = 0;
-    // Lee una linea completa y convierte en token.
-    // Inicializa todos los valores en cada celda.
-    while (fgets(lineBuffer, 1000, mapAltitudesFile) != NULL) {
-      j = 0;
-      token = strtok(lineBuffer, ",");
-      while (token) {
-        if (j < maxColumns) {
-          altitudeValue = atof(token);
-          map[i * maxColumns + j].altitude = altitudeValue;
-          map[i * maxColumns + j].thickness = 0;
-          map[i * maxColumns + j].isVent = 0;
-          map[i * maxColumns + j].temperature = 273.0;
-          map[i * maxColumns + j].yield = 0.0;
-          map[i * maxColumns + j].viscosity = 0.0;
-          map[i * maxColumns + j].exits = 0;
-          j += 1;
-        }
-        token = strtok(NULL, ",");
-      }
-      if (j >= maxColumns) {
-        i += 1;
-      }
-    }
-    printf("\n\t- Terreno inicializado correctamente.");
-    fclose(mapAltitudesFile);
-    return 1;
-  } else {
-    printf("\nERROR: Mapa de alturas no encontrado!");
-    return 0;
-  }
-}
-
-/* La función prefunción "agranda" la matriz, colocando una fila y una
- * columna al principio y al final (la matriz tiene dimensiones (MAX_ROWS
- * +2)*(MAX_COLS+2). De antemano me disculpo por la cantidad de veces que
- * imprimo la matriz. */
-void preFuncion(int filas, int columnas, const mapCell *A, mapCell *C) {
-  int i, j, c, f;
-  printf("\nAgregando filas y columnas extras en los bordes...\n");
-  // cargar matriz a memoria
-  // y acá debería agrandar la matriz
-  // las celdas extras tienen altitud 100000 metros, grosor de capas 0,
-  // temperatura 0
-  mapCell *B;
-  B = (mapCell *)malloc((filas + 2) * (columnas + 2) * sizeof(mapCell));
-  // crear elementos para la matriz agrandada. B[filas+2][columnas+2];
-  f = 0;
-  for (i = 0; i < filas + 2; ++i) {
-    if (!(i == 0 || i == (filas + 1))) {
-      c = 0;
-      for (j = 0; j < columnas + 2; ++j) {
-        if (!(j == 0 || j == (columnas + 1))) {
-          // acá van los valores no en los bordes
-          B[(columnas + 2) * i + j].altitude = A[(columnas)*f + c].altitude;
-          B[(columnas + 2) * i + j].thickness = A[(columnas)*f + c].thickness;
-          B[(columnas + 2) * i + j].temperature =
-              A[(columnas)*f + c].temperature;
-          B[(columnas + 2) * i + j].isVent = A[(columnas)*f + c].isVent;
-          B[(columnas + 2) * i + j].yield = 0;
-          B[(columnas + 2) * i + j].viscosity = 0;
-          B[(columnas + 2) * i + j].exits = 0;
-          B[(columnas + 2) * i + j].inboundV = 0;
-          B[(columnas + 2) * i + j].outboundV = 0;
-          B[(columnas + 2) * i + j].inboundQ = 0;
-          c += 1;
-          // llenar los valores originales
-          // ya que acá se trate de los posiciones diferentes a los
-          // nuevos bordes.
-        } else {
-          // crear las filas y columnas extras
-          // en la fila y columna 0, y en la fila y columna
-          // filas y columnas, o sea los máximos.
-          // esos valores son 0 y altitud muy grande, más grande
-          // que la altitud del everest.
-          // en este caso son solo los bordes de las "columnas"
-          B[(columnas + 2) * i + j].altitude = 100000;
-          B[(columnas + 2) * i + j].thickness = 0;
-          B[(columnas + 2) * i + j].temperature = 0;
-          B[(columnas + 2) * i + j].isVent = 0;
-          B[(columnas + 2) * i + j].yield = 0;
-          B[(columnas + 2) * i + j].viscosity = 0;
-          B[(columnas + 2) * i + j].exits = 0;
-          B[(columnas + 2) * i + j].inboundV = 0;
-          B[(columnas + 2) * i + j].outboundV = 0;
-          B[(columnas + 2) * i + j].inboundQ = 0;
-        }
-      }
-      f += 1;
-    } else {
-      for (j = 0; j < columnas + 2; ++j) {
-        // crear las filas y columnas extras
-        // en la fila y columna 0, y en la fila y columna
-        // filas y columnas, o sea los máximos.
-        // esos valores son 0 y altitud muy grande, más grande
-        // que la altitud del everest.
-        // en este caso son solo los bordes de las "filas"
-        B[(columnas + 2) * i + j].altitude = 100000;
-        B[(columnas + 2) * i + j].thickness = 0;
-        B[(columnas + 2) * i + j].temperature = 0;
-        B[(columnas + 2) * i + j].isVent = 0;
-        B[(columnas + 2) * i + j].yield = 0;
-        B[(columnas + 2) * i + j].viscosity = 0;
-        B[(columnas + 2) * i + j].exits = 0;
-        B[(columnas + 2) * i + j].inboundV = 0;
-        B[(columnas + 2) * i + j].outboundV = 0;
-        B[(columnas + 2) * i + j].inboundQ = 0;
-      }
-    }
-  }
-  // acá se copia la nueva matriz a la matrix pasada por referencia
-  // esa será el resultado.
-  memcpy(C, B, (filas + 2) * (columnas + 2) * sizeof(mapCell));
-  printf("Salir de la función agrandar...\n");
-  // En C se guardaron los resultados.
-  // Llamamos la función principal, la que hace los cálculos de la
-  // simulación:
-  // FuncionPrincipal(MAX_ROWS+1, MAX_COLS+1, B, C);
-}
-
 /* La función postfunción "reduce" la matriz, eliminando una fila y una
 columna al principio y al final (la matriz tiene dimensiones (MAX_ROWS
-+2)*(MAX_COLS+2) y el resultado MAX_ROWS*MAX_COLS. */
-void postFuncion(int filas, int columnas, const mapCell *A, mapCell *C, int rank, int size) {
-  // veamos si entra a la funcion
-  int i, j;
-  printf("eliminando filas y columnas extras de la matriz...\n");
-  mapCell *B;
-  int n_columnas = columnas - 2;
-  int n_filas = filas - 2;
-  B = (mapCell *)malloc(n_filas * n_columnas * sizeof(mapCell));
-  int f, c;
-  c = 0;
-  f = 0;
-
-  // Distribuir filas entre los procesos
-  int num_rows = n_filas / size;
-  int remainder = n_filas % size;
-  int start_row = rank * num_rows + (rank < remainder ? rank : remainder);
-  int end_row = start_row + num_rows + (rank < remainder);
-
-  // reducir la matriz
-  for (i = start_row; i < end_row; i++) {
-    c = 0;
-    for (j = 0; j < columnas; j++) {
-      if (!(j == 0 || j >= (columnas - 1))) {
-        B[(i-start_row) * n_columnas + c].altitude = A[i * columnas + j].altitude;
-        B[(i-start_row) * n_columnas + c].thickness = A[i * columnas + j].thickness;
-        B[(i-start_row) * n_columnas + c].temperature = A[i * columnas + j].temperature;
-        B[(i-start_row) * n_columnas + c].isVent = A[i * columnas + j].isVent;
-        B[(i-start_row) * n_columnas + c].yield = A[i * columnas + j].yield;
-        B[(i-start_row) * n_columnas + c].viscosity = A[i * columnas + j].viscosity;
-        B[(i-start_row) * n_columnas + c].exits = A[i * columnas + j].exits;
-        B[(i-start_row) * n_columnas + c].inboundV = A[i * columnas + j].inboundV;
-        B[(i-start_row) * n_columnas + c].outboundV = A[i * columnas + j].outboundV;
-        c += 1;
-      }
-    }
++2)*(MAX_COLS+2) y el resultado MAX_ROWS*MAX_COLS).  Cada proceso escribe
+las celdas interiores de sus filas propias en el archivo path, una
+instantánea binaria del paso paso, sin reunirlas en el proceso 0 (ver
+instantaneas_mpi.c).  Todos los procesos deben llamarla.  Devuelve 0 si
+hubo un error. */
+int postFuncion(const franjaLocal *F, const char *path, int paso) {
+  if (F->rank == 0) {
+    printf("Escribiendo el estado final en %s\n", path);
   }
-
-  // Recolectar resultados
-  MPI_Gather(B, num_rows * n_columnas, MPI_DOUBLE, C, num_rows * n_columnas, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-
-  // Liberar memoria
-  free(B);
+  return escribirInstantaneaColectiva(path, F, paso);
 }
 
-
 // declaración de la variable global que guarda las condiciones iniciales
 // no es muy recomendable, pero no hay tanto tiempo.
 initialConditions c0;
 
-// Esta es la función donde se calcula todo.
-// en la versión CUDA es sustituida.
-void FuncionPrincipal(int filas, int columnas, mapCell *A, mapCell *C) {
-  // falta hacer una función visualizar que ignore las columnas extras
-  // Asumimos al iniciar la función que la matriz ya viene aumentada.
-  int i, j, l, m;
-  int flujos = 0;
-  double deltaV = 0.0, deltaT = 0.0, deltaH = 0.0, maxV = 0.0;
-  double deltaQ = 0.0, deltaQ_rad = 0.0, deltaQ_flu = 0.0;
-  double Q_base = 0.0;
-  double Aref = 0.0, Href = 0.0;
-  double Acomp = 0.0, Hcomp = 0.0, Hcrit = 0.0, Hcrit2 = 0.0;
-  double cArea = c0.cellWidth * c0.cellWidth;
-  double alfa = 0.0;
-  // primer ciclo que es solo para inicializar
-  for (i = 1; i < filas - 1; i++) {
-    for (j = 1; j < columnas - 1; j++) {
-      // primero calcular la viscosidad y el yield, e inicializar los flujos
-      A[i * columnas + j].viscosity = visc(A[i * columnas + j].temperature);
-      A[i * columnas + j].yield = yield(A[i * columnas + j].temperature);
-      A[i * columnas + j].inboundV = 0.0;
-      A[i * columnas + j].inboundQ = 0.0;
-      A[i * columnas + j].outboundV = 0.0;
-      A[i * columnas + j].exits = 0;
-    }
-  }
-  // ciclo para evaluar la cantidad de salidas que tiene cada celda
-  for (i = 1; i < filas - 1; i++) {
-    for (j = 1; j < columnas - 1; j++) {
-      Href = A[i * (columnas) + j].thickness;
-      Aref = A[i * (columnas) + j].altitude;
-      flujos = 0;
-      for (l = -1; l < 2; l++) {
-        for (m = -1; m < 2; m++) {
-          if (!(m == 0 && l == 0)) {
-            int ni = i + l;
-            int nj = j + m;
-            Acomp = A[(ni) * (columnas) + (nj)].altitude;
-            Hcomp = A[(ni) * (columnas) + (nj)].thickness;
-            // alfa = atan((Acomp-Aref)/c0.anchoCelda);
-            Hcrit =
-                fabs((A[(ni) * (columnas) + (nj)].yield *
-                      sqrt((Acomp - Aref) * (Acomp - Aref) +
-                           c0.cellWidth * c0.cellWidth)) /
-                     (density * gravity * ((Acomp - Aref) - (Hcomp - Href))));
-            if ((Hcomp > Hcrit) && (Hcrit > 1e-8)) {
-              // mas depuración
-              // como esta operacion se repite es mejor hacerla una sola vez
-              // calcular el valor del volumen que sale
-              if (fabs(Hcomp + Acomp) >
-                  fabs(Href + Aref)) { // aca ya asumi que es plano
-                A[ni * (columnas) + nj].exits += 1;
-              }
-            }
-          }
-        }
-      }
+// primer ciclo que es solo para inicializar la viscosidad y el yield,
+// en las filas [f0, f1) de la franja.  Todas las fases recorren solo los
+// tramos activos de cada fila, y como las filas tienen trabajo muy distinto
+// se reparten dinámicamente entre los hilos.
+static void calcularReologia(franjaLocal *F, int f0, int f1) {
+  int i, columnas = F->columnas;
+  mapGrid *A = &F->celdas;
+  double t = marcaFase();
+#pragma omp parallel for schedule(dynamic, 4)
+  for (i = f0; i < f1; i++) {
+    int j0, j1 = 0;
+    while (siguienteTramo(F, i, &j0, &j1)) {
+      nucleos.reologia(&A->temperature[i * columnas + j0],
+                       &A->viscosity[i * columnas + j0],
+                       &A->yield[i * columnas + j0], j1 - j0);
     }
   }
+  sumarFase(fase_reologia, t);
+}
 
-  // acá solo se calculan los flujos, en el primer ciclo.  Como uno de los
-  // los supuestos de los autómatas celulares es que los estados solo se
-  // actualizan al final, se necesita un segundo ciclo.  Esto es crucial para el
-  // mapeo.
-  for (i = 1; i < filas - 1; i++) {
-    for (j = 1; j < columnas - 1; j++) {
-      double deltaQ_flu_vent = 0.0;
-      if (A[i * columnas + j].isVent == 1) {
-        // variables temporales para almacenar el delta de volumen y de
-        // temperatura. si hay un crater se aumenta el thickness en un valor
-        // igual a la tasa de erupción sobre el area de la celda por el delta de
-        // tiempo
-        deltaV = (c0.eruptionRate) * c0.deltat;
-        A[i * columnas + j].inboundV += (deltaV);
-        deltaQ_flu_vent =
-            (deltaV * c0.eruptionTemperature) * heatCapacity * density;
-        A[i * columnas + j].inboundQ += deltaQ_flu_vent;
-        // printf("\nCrater %d,%d inbound %lf ", i-1, j-1, deltaV);
-      }
-      deltaV = 0.0;
-      deltaH = 0.0;
-      // depuracion, recordar que las celda se cuentan descartando las filas y
-      // columnas extras printf("\n\n\nDatos de la celda %d,%d : Altitud: %lf -
-      // Grosor: %lf - Temperatura: %lf - Viscosidad: %lf - Esfuerzo: %lf\n",
-      // i-1, j-1, A[i*columnas+j].altitude, A[i*columnas+j].thickness,
-      // A[i*columnas+j].temperature, A[i*columnas+j].viscosity,
-      // A[i*columnas+j].yield); acá arranco el proceso de detectar cuantos
-      // flujos salen de una celda y de esta manera puedo saber como dividir el
-      // flujo cuando necesite sumarlos en el paso siguiente. reviso las celdas
-      // adyacentes:
-      Href = A[i * (columnas) + j].thickness;
-      Aref = A[i * (columnas) + j].altitude;
-      // printf("\n\nEl valor de flujos que sale de %d,%d es %d
-      // \n",i-1,j-1,A[i*(columnas) + j].exits); crear el ciclo que recorre los
-      // adyacentes y calcula el grosor critico en los flujos, agregar el deltaV
-      // correcto. y el correspondiente deltaQ comparar a ver cuantas salidas
-      // tiene cada celda. aca pongo salidas de depuración printf("Analizando
-      // flujos de lava relacionados con la celda %d,%d que tiene valores de
-      // altitud %lf y grosor de capa %lf:\n", i-1, j-1, Aref, Href); aca
-      // calculo los flujos como tal, vamos a calcular directamente, sin
-      // provisión de orden en los flujos, agregar el deltaV correcto. y el
-      // correspondiente deltaQ
-      for (l = -1; l < 2; l++) {
-        for (m = -1; m < 2; m++) {
-          if (!(m == 0 && l == 0)) {
-            int ni = i + l;
-            int nj = j + m;
-            Acomp = A[(ni) * (columnas) + (nj)].altitude;
-            Hcomp = A[(ni) * (columnas) + (nj)].thickness;
-            deltaH = Hcomp - Href;
-            // alfa = atan((Acomp-Aref)/c0.anchoCelda);
-            alfa = 0;
-            // printf("\nComparando celda %d,%d con %d,%d (ref)  Angulo %lf,
-            // Acomp: %lf - Aref: %lf - Cos alfa %lf, Sin alfa %lf -- yield %lf
-            // - visc %lf - gravedad %lf densidad %lf - ancho %lf", ni-1, nj-1,
-            // i-1, j-1, alfa/M_PI, Acomp, Aref, cos(alfa), sin(alfa),
-            // A[(ni)*(columnas)+(nj)].yield, A[(ni)*(columnas)+(nj)].viscosity,
-            // gravity, density, c0.anchoCelda);
-            Hcrit = fabs((A[(ni) * (columnas) + (nj)].yield *
-                          sqrt((Acomp - Aref) * (Acomp - Aref) +
-                               c0.cellWidth * c0.cellWidth)) /
-                         (density * gravity * ((Acomp - Aref) - (deltaH))));
-            // Hcrit =
-            // ((A[(ni)*(columnas)+(nj)].yield)/((density*gravity)*(sin(alfa)-((Hcomp-Href)/c0.anchoCelda)*cos(alfa))));
-            // esta version funcionaría perfecto para topografías planas? o por
-            // el angulo ya esta incluido? hallar el grosor critico para cada
-            // celda adyacente. Hcrit=(Hcomp-Href)/c0.anchoCelda; salidas de
-            // depuración que hacen falta
-            // printf("Comparando con celda %d,%d que tiene valores de altitud
-            // %lf y grosor de capa %lf: -- grosor critico %lf \n", ni, nj,
-            // Acomp, Hcomp, Hcrit);
-            // printf("\nEl Hcomp es %lf, el Href es %lf, el ancho es %lf, El Hc
-            // es %lf, salidas de la celda de comp %d, celda %d,%d", Hcomp,
-            // Href, c0.anchoCelda, Hcrit, A[ni*(columnas)+nj].exits, ni-1,
-            // nj-1);
-            if ((Hcomp > Hcrit) && (Hcrit > 1e-8)) {
-              // mas depuración
-              // como esta operacion se repite es mejor hacerla una sola vez
-              double h_hc = Hcomp / Hcrit;
-              // calcular el valor del volumen que sale
-              if ((fabs(Hcomp + Acomp) > fabs(Href + Aref)) &&
-                  (A[ni * (columnas) + nj].exits > 0)) {
-
-                // aca ya asumi que es plano
-                // deltaV =
-                // (1.0/A[ni*(columnas)+nj].exits)*((A[ni*columnas+nj].yield*Hcrit*Hcrit*c0.anchoCelda)/(3*A[ni*columnas+nj].viscosity))*(h_hc*h_hc*h_hc-1.5*h_hc*h_hc+0.5)*(delta_t);
-                // estoy jugando
-                deltaV = (1.0 / A[ni * (columnas) + nj].exits) *
-                         ((A[ni * columnas + nj].yield * Hcrit * Hcrit *
-                           c0.cellWidth) /
-                          (3 * A[ni * columnas + nj].viscosity)) *
-                         (h_hc * h_hc * h_hc - 1.5 * h_hc * h_hc + 0.5) *
-                         (c0.deltat);
-                maxV = (deltaH * cArea) / (2 * A[ni * (columnas) + nj].exits);
-                if (maxV < deltaV) {
-                  // luz, fuego, destrucción
-                  deltaV = maxV;
-                }
-              } else {
-                deltaV = 0.0;
-              }
-              // printf("\nEl valor de dv que sale de %d,%d es
-              // %lf",ni-1,nj-1,deltaV); El volumen cedido se suma al volumen
-              // total a restar a la celda Y tambien al volumen a sumar.
-              // machetazos horribles
-              A[(ni) * (columnas) + (nj)].outboundV += (deltaV);
-              A[(i) * (columnas) + (j)].inboundV += (deltaV);
-              A[(i) * (columnas) + (j)].inboundQ +=
-                  deltaV * A[ni * columnas + nj].temperature * density *
-                  heatCapacity;
-              // se incluye un estimado del calor transferido, temp del origen
-              // por delta
-              // A[(i)*(columnas)+(j)].inboundQ += (deltaV *
-              // A[ni*columnas+nj].temperature) * heatCapacity * density;
-              // A[(ni)*(columnas)+(nj)].inboundQ -= (deltaV *
-              // A[ni*columnas+nj].temperature) * heatCapacity * density;
-              // reviso el número de flujos
-              // flujos += 1;
-              // calcular el inboundQ por flujos
-            }
-          }
-        }
-      }
-      // aca se agregan los flujos en caso de ser un crater
-      // acá sumamos los volumenes y convertimos en grosor
+// filas de flujos de cada bloque cuando las filas se reparten entre hilos
+#define filas_bloque 64
+
+// Volúmenes que cede la fila r a sus vecinas, en el lugar r % 3 del anillo
+// de tres filas del hilo, y sus salidas si escribir es 1.  Se calculan en
+// los tramos que leen los flujos de las filas r - 1, r y r + 1; las filas de
+// los bordes de la matriz agrandada no ceden nada.
+static void volumenesFila(franjaLocal *F, double *const *anillo, int r,
+                          int escribir) {
+  double *const *cedido = anillo + (r % 3) * 8;
+  int g = r + F->filaInicio - filas_halo; // fila de la matriz agrandada
+  int d, j0, j1 = 0;
+  if (g <= 0 || g > F->filas) {
+    for (d = 0; d < 8; d++) {
+      memset(cedido[d], 0, F->columnas * sizeof(double));
     }
+    return;
   }
-  // segundo ciclo, consolidamos los flujos, calculamos nuevos grosores
-  // y temperaturas.
-  // luego agregamos crateres y calculamos la temperatura perdida por radiacion
-
-  for (i = 1; i < filas - 1; i++) {
-    for (j = 1; j < columnas - 1; j++) {
-      deltaT = 0.0;
-      deltaQ = 0.0;
-      deltaQ_rad = 0.0;
-      deltaQ_flu = 0.0;
-      Q_base = 0.0;
-      double deltaQ_flu_in = 0.0, deltaQ_flu_out = 0.0;
-      double thickness_0 = 0.0, temperature_0 = 0.0;
-      // Solo necesito calcular el valor de T teniendo en cuenta el calor
-      // y el valor de thickness teniendo en cuenta el volumen
-      // balance de volumenes, ojo.
-      thickness_0 = A[i * columnas + j].thickness;
-      temperature_0 = A[i * columnas + j].temperature;
-      Q_base = thickness_0 * temperature_0 * density * heatCapacity;
-      // Cuando el grosor el negligible con relación al area, no hay perdida de
-      // calor if (A[i*columnas+j].thickness > 1e-8) {
-      if (A[i * columnas + j].thickness > 1e-4) {
-        // A[i*columnas+j].temperature = (A[i*columnas+j].inboundQ +
-        // (thickness_0 * cArea *
-        // A[i*columnas+j].temperature))/(A[i*columnas+j].thickness * cArea);
-        deltaQ_rad =
-            (-1.0) * SBConst * (cArea)*emisivity * c0.deltat *
-            (A[i * columnas + j].temperature * A[i * columnas + j].temperature *
-             A[i * columnas + j].temperature * A[i * columnas + j].temperature);
-      } else {
-        deltaQ_rad = 0;
-      }
-      A[i * columnas + j].thickness = thickness_0 +
-                                      (A[i * columnas + j].inboundV / (cArea)) -
-                                      (A[i * columnas + j].outboundV / (cArea));
-      deltaQ_flu_in = A[i * columnas + j].inboundQ;
-      deltaQ_flu_out = A[i * columnas + j].outboundV * temperature_0 * density *
-                       heatCapacity;
-      deltaQ_flu = deltaQ_flu_in - deltaQ_flu_out;
-      // revisar por 0 en el thickness y no hacer la operacion en ese caso
-      // calculo de la perdida, un nuevo deltaQ
-      // printf("\nPara Celda %d,%d antes de crateres el valor de");
-      // printf("\nPara Celda %d,%d antes de crateres el valor de grosor es %lf,
-      // el de calor por flujo %lf, el de calor perdido por radiacion es %lf, el
-      // de calor base es %lf, el de temperatura es %lf \n", i-1, j-1,
-      // A[i*columnas + j].thickness, deltaQ_flu, deltaQ_rad, Q_base,
-      // A[i*columnas + j].temperature); printf("\nPara Celda %d,%d antes de
-      // crateres el valor de calor de salida es %lf, de calor de entrada es
-      // %lf", i-1, j-1, deltaQ_flu_out, deltaQ_flu_in); mensajes de depuración.
-      // Acá se cálcula si es un crater o no, y con eso se cálcula
-      // un nuevo grosor.
-      // se revisa si en la celda hay un crater
-      deltaQ = Q_base + deltaQ_flu + deltaQ_rad;
-      if (A[i * columnas + j].thickness > 1e-8) {
-        A[i * columnas + j].temperature =
-            deltaQ /
-            (density * heatCapacity * cArea * A[i * columnas + j].thickness);
-      } else {
-        A[i * columnas + j].temperature = 273.0;
-      }
-      // printf("\nPara Celda %d,%d despues de crateres el valor de grosor es
-      // %lf, el de calor por flujo %lf, el de calor perdido por radiacion es
-      // %lf, el de calor base es %lf, el de temperatura es %lf, el calor
-      // agregado por crater es bastante", i-1, j-1, A[i*columnas +
-      // j].thickness, deltaQ_flu, deltaQ_rad, Q_base, A[i*columnas +
-      // j].temperature); printf("\nEl la celda %d,%d el valor de grosor es %lf,
-      // el de inbound es %lf y el de outboud es %lf.  El valor de calor es %lf
-      // - la temperatura anterior es %lf, el grosor anterior es %lf", i-1, j-1,
-      // A[i*columnas+j].thickness, A[i*columnas+j].inboundV,
-      // A[i*columnas+j].outboundV, A[i*columnas+j].inboundQ, temperature_0,
-      // thickness_0); printf("\nParametros cArea %lf, heatCapacity %lf, density
-      // %lf temp %lf", cArea, heatCapacity, density,
-      // A[i*columnas+j].temperature); printf("\nDeltaT %lf - Grosor: %lf -
-      // deltaQ_rad %lf - inboundQ %lf\n\n", deltaT,
-      // A[(i)*(columnas)+(j)].thickness, deltaQ_rad, A[i*columnas+j].inboundQ);
-    }
+  while (siguienteTramoVecino(F, r, &j0, &j1)) {
+    nucleos.salidas(&F->celdas, r, j0, j1, cedido, escribir);
   }
-  memcpy(C, A, filas * columnas * sizeof(mapCell));
 }
 
-// nota, falta implementar las cifras significativas
-int prepararVisualizacionGNUPlot(int secuencia, char *path, int filas,
-                                 int columnas, mapCell *matriz,
-                                 int cifrasSignif, double w, double x0,
-                                 double y0) {
-  // Esta función genera los dos archivos necesarios para producir una imagen
-  // en GNU plot.  Los archivos son:
-  // 1. datafile.dat (o variantes) que contiene los datos de altitud,
-  // temperatura y grosor de la capa, teniendo en cuenta que altitud ya tiene en
-  // cuenta el de la capa, pero este se incluye para dar mas opciones
-  // 2. archivo de comandos, que incluye lo necesario para poder configurar
-  // el área de dibujo, las escalas, las leyendas, etc.
-  // Los parámetros son matriz, que es la matriz completa con los resultados
-  // nombreArchivo, que es el nombre base de los archivos de datos a producir
-  // y secuencia, en el caso en el que se produzcan varios archivos para
-  // generar una animación, nos dará el orden.  El resultado es un plot de gnu
-  // plot mas una imagen png exportada a partir de eso, que llevará como nombre
-  // nombreArchivo + secuencia.png
-  FILE *datosAltitud;
-  FILE *encabezado;
-  size_t sizep;
-  int i, j, flag;
-  double xcoord, ycoord, zcoord, temp;
-  sizep = strlen(path);
-  long int cont;
-  char newpath[500], tsec[20], pathenca[550], command[700], f_path[1024];
-  // printf("\nNumero de caracteres de la ruta del archivo %d\n",(int)sizep);
-  if (sizep != 0) {
-    strcpy(newpath, path);
-    sprintf(tsec, "%d", secuencia);
-    strcat(newpath, tsec);
-    printf("Escribiendo archivo: %s\n", newpath);
-    datosAltitud = fopen(newpath, "w");
-    if (datosAltitud != NULL) {
-      printf("Guardando en archivo...\n");
-      // Escribiendo los datos
-      cont = 0;
-      for (j = 0; j < columnas; ++j) { // aca debo cambiar esto, altitude +
-                                       // thickness da la altura, osea la z
-        for (i = 0; i < filas; ++i) {
-          xcoord = x0 + i * w;
-          ycoord = y0 + j * w;
-          zcoord = matriz[columnas * i + j].thickness +
-                   matriz[columnas * i + j].altitude;
-          temp = matriz[columnas * i + j].temperature;
-          fprintf(datosAltitud, "%6.3lf %6.3lf %6.3lf %6.3lf\n", xcoord, ycoord,
-                  zcoord, temp);
-          cont += 1;
+// Salidas de las filas [e0, e1) y flujos de las filas [f0, f1) en una sola
+// pasada.  Cada celda revisa sus 8 vecinas una vez y deja el volumen que les
+// cede en un anillo de tres filas; los flujos de la fila i se calculan
+// apenas están los volúmenes de la fila i + 1, así que los datos de cada
+// fila se leen una sola vez mientras están en la caché.  Las salidas de una
+// celda dependen de sus vecinas y los flujos de los volúmenes de las
+// vecinas, así que los flujos de [f0, f1) necesitan los volúmenes de
+// [f0 - 1, f1 + 1).
+//
+// Con varios hilos las filas de flujos se reparten en bloques de
+// filas_bloque filas y cada bloque recalcula los volúmenes de la fila
+// anterior y la siguiente.  Cada fila de exits la escribe un solo bloque, y
+// como nadie escribe fuera de sus celdas el resultado con hilos es idéntico
+// al secuencial.
+static void calcularSalidasYFlujos(franjaLocal *F, int e0, int e1, int f0,
+                                   int f1) {
+  int v0 = e0, v1 = e1, bloque, bloques, b;
+  int columnas = F->columnas;
+  double t = marcaFase();
+  if (f0 < f1) {
+    v0 = (e0 < e1 && e0 < f0 - 1) ? e0 : f0 - 1;
+    v1 = (e0 < e1 && e1 > f1 + 1) ? e1 : f1 + 1;
+    bloque = (F->hilos > 1) ? filas_bloque : f1 - f0;
+    bloques = (f1 - f0 + bloque - 1) / bloque;
+  } else {
+    bloque = 0;
+    bloques = (e0 < e1) ? 1 : 0;
+  }
+#pragma omp parallel for schedule(dynamic, 1)
+  for (b = 0; b < bloques; b++) {
+    double *anillo[24], *filas[24];
+    double *base = F->cedidos;
+    int b0 = f0 + b * bloque, b1 = b0 + bloque;
+    int r0 = b0 - 1, r1 = b1 + 1, r, d, k;
+    if (b1 > f1) {
+      b1 = f1;
+      r1 = b1 + 1;
+    }
+#ifdef _OPENMP
+    base += (size_t)omp_get_thread_num() * 24 * columnas;
+#endif
+    for (d = 0; d < 24; d++) {
+      anillo[d] = base + (size_t)d * columnas;
+    }
+    // el primer y el último bloque también hacen las filas de salidas
+    // que quedan fuera de las de flujos
+    if (b == 0) {
+      r0 = v0;
+    }
+    if (b == bloques - 1) {
+      r1 = v1;
+    }
+    for (r = r0; r < r1; r++) {
+      // cada fila de exits la escribe el bloque que tiene su fila de flujos
+      int propia = (b == 0 || r >= b0) && (b == bloques - 1 || r < b1);
+      volumenesFila(F, anillo, r, propia && r >= e0 && r < e1);
+      if (r - 1 >= b0 && r - 1 < b1) {
+        int i = r - 1, j0, j1 = 0;
+        for (k = 0; k < 3; k++) {
+          for (d = 0; d < 8; d++) {
+            filas[k * 8 + d] = anillo[((i - 1 + k) % 3) * 8 + d];
+          }
+        }
+        while (siguienteTramo(F, i, &j0, &j1)) {
+          nucleos.flujos(&F->celdas, i, j0, j1, filas);
         }
-        // para las isolineas
-        fprintf(datosAltitud, "\n");
       }
-      printf("Se escribieron %ld elementos.\n\n", cont);
-      fclose(datosAltitud);
-    } else {
-      printf("***\nError al intentar escribir el archivo de datos.\n***\n\n");
-    }
-    strcpy(pathenca, newpath);
-    strcat(pathenca, "_enca");
-    printf("Guardando archivo de encabezado %s \n", pathenca);
-    encabezado = fopen(pathenca, "w");
-    if (encabezado != NULL) {
-      // escribiendo el encabezado, pero en GNUPLOT es diferente
-      // se muestran opciones para png y eps
-      // fprintf(encabezado,"set terminal png size 400,300 enhanced font
-      // \"Helvetica,20\"\n\n",newpath);
-      fprintf(encabezado, "set terminal png size 1366,720 enhanced\n\n",
-              newpath);
-      fprintf(encabezado, "set output '%s.png'\n", newpath);
-      // dejo estas líneas comentadas por si necesito configurar mejor
-      // la visualización.
-      // fprintf(encabezado,"set term postscript eps enhanced color\n");
-      // fprintf(encabezado,"set output '%s.eps'\n",newpath);
-      // fprintf(encabezado,"set autoscale y #set	autoscale	# scale
-      // axes automatically\n"); fprintf(encabezado,"unset label	# remove
-      // any previous labels\n"); fprintf(encabezado,"set encoding utf8\n\n");
-      // fprintf(encabezado,"set isosamples 100\n");
-      // fprintf(encabezado,"set samples 100\n\n");
-      // fprintf(encabezado,"unset key\n");
-      // fprintf(encabezado,"unset grid\n");
-      // fprintf(encabezado,"unset border\n");
-      // fprintf(encabezado,"unset tics\n");
-      fprintf(encabezado, "set xrange [0:20]\n");
-      fprintf(encabezado, "set yrange [0:20]\n");
-      fprintf(encabezado, "set zrange [0:20]\n\n");
-      fprintf(encabezado, "set colorbox\n");
-      // fprintf(encabezado,"unset surface\n");
-      fprintf(encabezado, "set pm3d\n");
-      fprintf(encabezado, "set title \"%d\"\n\n", secuencia);
-      fprintf(encabezado, "splot \"%s\" using 1:2:3:4 with pm3d\n", newpath);
-      fprintf(encabezado, "reset\n");
-      fclose(encabezado);
-    } else {
-      printf(
-          "\n***\nError al intentar escribir el archivo de ecabezado.\n***\n");
     }
-    // se ejecuta el gnu plot para generar el archivo de imagen
-    limpiarPath(pathenca, f_path);
-    strcpy(command, "gnuplot ");
-    strcat(command, f_path);
-    printf("Ejecutando comando: %s\n", command);
-    flag = system(command);
-    printf("Mensaje del comando %d\n", flag);
   }
+  sumarFase(fase_salidas_flujos, t);
 }
 
-// Esta es una copia de la funcion anterior que ignora los espacios extras
-// de la matriz aumentada
-int prepararVisualizacionGNUPlot_2(int secuencia, char *path, int filas,
-                                   int columnas, mapCell *matriz,
-                                   int cifrasSignif, double w, double x0,
-                                   double y0) {
-  // Esta función genera los dos archivos necesarios para producir una imagen
-  // en GNU plot.  Los archivos son:
-  // 1. datafile.dat (o variantes) que contiene los datos de altitud,
-  // temperatura y grosor de la capa, teniendo en cuenta que altitud ya tiene en
-  // cuenta el de la capa, pero este se incluye para dar mas opciones
-  // 2. archivo de comandos, que incluye lo necesario para poder configurar
-  // el área de dibujo, las escalas, las leyendas, etc.
-  // Los parámetros son matriz, que es la matriz completa con los resultados
-  // nombreArchivo, que es el nombre base de los archivos de datos a producir
-  // y secuencia, en el caso en el que se produzcan varios archivos para
-  // generar una animación, nos dará el orden.  El resultado es un plot de gnu
-  // plot mas una imagen png exportada a partir de eso, que llevará como nombre
-  // nombreArchivo + secuencia.png
-  FILE *datosAltitud;
-  FILE *encabezado;
-  size_t sizep;
-  int i, j, flag;
-  double xcoord, ycoord, zcoord, temp;
-  sizep = strlen(path);
-  long int cont;
-  char newpath[500], tsec[20], pathenca[550], command[700], f_path[1024];
-  // printf("\nNumero de caracteres de la ruta del archivo %d\n",(int)sizep);
-  if (sizep != 0) {
-    strcpy(newpath, path);
-    sprintf(tsec, "%d", secuencia);
-    strcat(newpath, tsec);
-    printf("Escribiendo archivo: %s\n", newpath);
-    datosAltitud = fopen(newpath, "w");
-    if (datosAltitud != NULL) {
-      printf("Guardando en archivo...\n");
-      // Escribiendo los datos
-      cont = 0;
-      for (j = 1; j < columnas - 1; ++j) { // aca debo cambiar esto, altitude +
-                                           // thickness da la altura, osea la z
-        for (i = 1; i < filas - 1; ++i) {
-          xcoord = x0 + (i - 1) * w;
-          ycoord = y0 + (j - 1) * w;
-          zcoord = matriz[columnas * i + j].thickness +
-                   matriz[columnas * i + j].altitude;
-          temp = matriz[columnas * i + j].temperature;
-          fprintf(datosAltitud, "%6.3lf %6.3lf %6.8lf %6.8lf\n", xcoord, ycoord,
-                  zcoord, temp);
-          cont += 1;
-        }
-        // para las isolineas
-        fprintf(datosAltitud, "\n");
-      }
-      printf("Se escribieron %ld elementos.\n\n", cont);
-      fclose(datosAltitud);
+// Consolida los flujos de las celdas [j0, j1) de la fila i: nuevos grosores
+// y temperaturas, con los cráteres y la temperatura perdida por radiación.
+// Si cambio no es NULL lo sube al mayor cambio relativo de grosor de las
+// celdas que ya tenían lava, y si radiacion no es NULL lo baja al menor dt
+// con el que la radiación del siguiente paso se llevaría todo el calor de
+// una celda.
+void consolidarTramo(mapGrid *A, int i, int j0, int j1, double *cambio,
+                     double *radiacion) {
+  int j, columnas = A->columnas;
+  double deltaQ = 0.0, deltaQ_rad = 0.0, deltaQ_flu = 0.0;
+  double Q_base = 0.0;
+  double cArea = c0.cellWidth * c0.cellWidth;
+  for (j = j0; j < j1; j++) {
+    int k = i * columnas + j;
+    double deltaQ_flu_in = 0.0, deltaQ_flu_out = 0.0;
+    double thickness_0 = 0.0, temperature_0 = 0.0;
+    // Solo necesito calcular el valor de T teniendo en cuenta el calor
+    // y el valor de thickness teniendo en cuenta el volumen
+    // balance de volumenes, ojo.
+    thickness_0 = A->thickness[k];
+    temperature_0 = A->temperature[k];
+    Q_base = thickness_0 * temperature_0 * density * heatCapacity;
+    // Cuando el grosor el negligible con relación al area, no hay perdida
+    // de calor if (A[i*columnas+j].thickness > 1e-8) {
+    if (A->thickness[k] > 1e-4) {
+      deltaQ_rad = (-1.0) * SBConst * (cArea)*emisivity * c0.deltat *
+                   (temperature_0 * temperature_0 * temperature_0 *
+                    temperature_0);
     } else {
-      printf("***\nError al intentar escribir el archivo de datos.\n***\n\n");
+      deltaQ_rad = 0;
+    }
+    A->thickness[k] = thickness_0 + (A->inboundV[k] / (cArea)) -
+                      (A->outboundV[k] / (cArea));
+    if (cambio != NULL && thickness_0 > 1e-4) {
+      double r = fabs(A->thickness[k] - thickness_0) / thickness_0;
+      *cambio = (r > *cambio) ? r : *cambio;
     }
-    strcpy(pathenca, newpath);
-    strcat(pathenca, "_enca");
-    printf("Guardando archivo de encabezado %s \n", pathenca);
-    encabezado = fopen(pathenca, "w");
-    if (encabezado != NULL) {
-      // escribiendo el encabezado, pero en GNUPLOT es diferente
-      // se muestran opciones para png y eps
-      // fprintf(encabezado,"set terminal png size 400,300 enhanced font
-      // \"Helvetica,20\"\n\n",newpath);
-      fprintf(encabezado, "set terminal png size 1366,720 enhanced\n\n",
-              newpath);
-      fprintf(encabezado, "set output '%s.png'\n", newpath);
-      // dejo estas líneas comentadas por si necesito configurar mejor
-      // la visualización.
-      // fprintf(encabezado,"set term postscript eps enhanced color\n");
-      // fprintf(encabezado,"set output '%s.eps'\n",newpath);
-      // fprintf(encabezado,"set autoscale y #set	autoscale	# scale
-      // axes automatically\n"); fprintf(encabezado,"unset label	# remove
-      // any previous labels\n"); fprintf(encabezado,"set encoding utf8\n\n");
-      // fprintf(encabezado,"set isosamples 100\n");
-      // fprintf(encabezado,"set samples 100\n\n");
-      // fprintf(encabezado,"unset key\n");
-      fprintf(encabezado, "set grid\n");
-      // fprintf(encabezado,"unset border\n");
-      // fprintf(encabezado,"unset tics\n");
-      fprintf(encabezado, "set xrange [0:%d]\n", filas - 2);
-      fprintf(encabezado, "set yrange [0:%d]\n", filas - 2);
-      fprintf(encabezado, "set zrange [0:3]\n\n");
-      fprintf(encabezado, "set colorbox\n");
-      // fprintf(encabezado,"unset surface\n");
-      fprintf(encabezado, "set pm3d\n");
-      fprintf(encabezado, "set title \"%d\"\n\n", secuencia);
-      fprintf(encabezado, "splot \"%s\" using 1:2:3:4 with pm3d\n", newpath);
-      fprintf(encabezado, "reset\n");
-      fclose(encabezado);
+    deltaQ_flu_in = A->inboundQ[k];
+    deltaQ_flu_out = A->outboundV[k] * temperature_0 * density * heatCapacity;
+    deltaQ_flu = deltaQ_flu_in - deltaQ_flu_out;
+    // Acá se cálcula si es un crater o no, y con eso se cálcula
+    // un nuevo grosor.
+    deltaQ = Q_base + deltaQ_flu + deltaQ_rad;
+    if (A->thickness[k] > 1e-8) {
+      A->temperature[k] =
+          deltaQ / (density * heatCapacity * cArea * A->thickness[k]);
     } else {
-      printf(
-          "\n***\nError al intentar escribir el archivo de ecabezado.\n***\n");
+      A->temperature[k] = 273.0;
+    }
+    // una celda a 0 K o menos ya no radia (y daría un dt negativo)
+    if (radiacion != NULL && A->thickness[k] > 1e-4 && A->temperature[k] > 0) {
+      double T = A->temperature[k];
+      double d = density * heatCapacity * A->thickness[k] /
+                 (SBConst * emisivity * T * T * T);
+      *radiacion = (d < *radiacion) ? d : *radiacion;
     }
-    // se ejecuta el gnu plot para generar el archivo de imagen
-    limpiarPath(pathenca, f_path);
-    strcpy(command, "gnuplot ");
-    strcat(command, f_path);
-    printf("Ejecutando comando: %s\n", command);
-    flag = system(command);
-    printf("Mensaje del comando %d\n", flag);
-  }
-}
-
-/*
- * Función para obtener el path actual, y de esta manera generar
- * las imagenes en el directorio actual.
- */
-int obtenerPath(char path[]) {
-  char cwd[1024];
-  if (getcwd(cwd, sizeof(cwd)) != NULL) {
-    fprintf(stdout, "Current working dir: %s\n", cwd);
-    strcpy(path, cwd);
-    return 0;
-  } else {
-    perror("getcwd() error");
-    return 1;
   }
 }
 
-// función para colocar \ donde sean necesarios y de esta manera
-// poder usar paths y nombres de archivos con espacios.
-int limpiarPath(char path[], char spath[]) {
-  char r_path[1024], f_path[1024];
-  int i, j;
-  int lg = 0;
-  strcpy(r_path, path);
-  lg = strlen(r_path);
-  j = 0;
-  for (i = 0; i < lg; ++i) {
-    if (r_path[i] == ' ') {
-      f_path[j] = '\\';
-      f_path[j + 1] = ' ';
-      j += 2;
-    } else {
-      f_path[j] = r_path[i];
-      j += 1;
+// segundo ciclo, consolidamos los flujos de las filas [f0, f1), calculamos
+// nuevos grosores y temperaturas.
+// Con el paso adaptativo también se guardan en F->cambioGrosor el mayor
+// cambio relativo de grosor del paso y en F->deltatRadiacion el menor dt con
+// el que la radiación del siguiente paso se llevaría todo el calor de una
+// celda.
+static void consolidarFlujos(franjaLocal *F, int f0, int f1) {
+  int i, adaptativo = c0.targetTime > 0;
+  double cambio = F->cambioGrosor, radiacion = F->deltatRadiacion;
+  double t = marcaFase();
+#pragma omp parallel for schedule(dynamic, 4) \
+    reduction(max : cambio) reduction(min : radiacion)
+  for (i = f0; i < f1; i++) {
+    int j0, j1 = 0;
+    while (siguienteTramo(F, i, &j0, &j1)) {
+      consolidarTramo(&F->celdas, i, j0, j1, adaptativo ? &cambio : NULL,
+                      adaptativo ? &radiacion : NULL);
     }
   }
-  f_path[j] = '\0';
-  strcpy(spath, f_path);
+  F->cambioGrosor = cambio;
+  F->deltatRadiacion = radiacion;
+  sumarFase(fase_consolidacion, t);
 }
 
-int generarAnimacionGNUPlot(char nombreArchivo[], int secuencia) {
-  /* ----------------------------------------------------------
-   * En construcción.
-   * "mencoder mf://*.%s -mf w=1366:h=720:fps=5:type=png -ovc copy -oac copy -o
-   * %S", "png", nombre.avi Función para generar un video a partir de imágenes
-   * fijas.
-   * ---------------------------------------------------------- */
+// filas fantasma se calculan las filas que no dependen de ellas; las
+// salidas de una celda dependen de sus vecinas y los flujos de las salidas
+// de las vecinas, así que cada fase pierde una fila más en cada borde.
+void FuncionPrincipal(franjaLocal *F) {
+  MPI_Request solicitudes[8];
+  int p0 = filas_halo;                   // primera fila propia
+  int p1 = filas_halo + F->filasPropias; // una después de la última propia
+  // filas fantasma que también hay que calcular (las de los bordes de la
+  // matriz agrandada no se calculan)
+  int g0 = (F->arriba != MPI_PROC_NULL) ? p0 - 1 : p0;
+  int g1 = (F->abajo != MPI_PROC_NULL) ? p1 + 1 : p1;
+  int s0 = (p0 + 2 < p1) ? p0 + 2 : p1;  // fin de los flujos del borde superior
+  int s1 = (p1 - 2 > s0) ? p1 - 2 : s0;  // inicio de los del borde inferior
+  double t, inicio = MPI_Wtime(), espera;
+
+  F->cambioGrosor = 0.0;
+  F->deltatRadiacion = HUGE_VAL;
+  iniciarIntercambioHalo(F, solicitudes);
+  // filas interiores de la franja
+  calcularReologia(F, p0, p1);
+  calcularSalidasYFlujos(F, p0 + 1, p1 - 1, s0, s1);
+  t = marcaFase();
+  espera = MPI_Wtime();
+  terminarIntercambioHalo(solicitudes);
+  espera = MPI_Wtime() - espera;
+  sumarFase(fase_halo, t);
+  // filas que dependen del halo
+  calcularReologia(F, g0, p0);
+  calcularReologia(F, p1, g1);
+  calcularSalidasYFlujos(F, g0, p0 + 1, p0, s0);
+  calcularSalidasYFlujos(F, p1 - 1, g1, s1, p1);
+  consolidarFlujos(F, p0, p1);
+  t = marcaFase();
+  actualizarActividad(F, 0);
+  sumarFase(fase_actividad, t);
+  F->segundosCalculo += MPI_Wtime() - inicio - espera;
 }
 
-// Acá va la función main.
 int main(int argc, char *argv[]) {
   int rank, size;
+#ifdef _OPENMP
+  // solo el hilo principal hace llamadas MPI
+  int nivelHilos;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &nivelHilos);
+#else
   MPI_Init(&argc, &argv);
+#endif
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
   MPI_Comm_size(MPI_COMM_WORLD, &size);
   int i, flag = 0;
-  mapCell *testPoint, *resultPoint, *resultCalc, *resultPoint2;
+  mapGrid resultPoint;
   point2D *crateres;
   int fila = 0;
   int columna = 0;
   int puntosCrater = 0;
   char s_path[1024];
-  char a_path[1024];
+  char a_path[1024] = "";
   char etiqueta[1024];
   char path[1024];
 
   int option;
-
-  while ((option = getopt(argc, argv, "t:v:w:s:a:r:c:p:e:n:")) != -1) {
+  char *nombreNucleos = NULL;
+  // marcos de la cola de instantáneas y qué hacer cuando está llena
+  int marcosInstantaneas = 2, descartarInstantaneas = 0;
+  // formato de las instantáneas y si las binarias son dispersas
+  int formatoInstantaneas = formato_gnuplot, instantaneasDispersas = 0;
+  // instantáneas escritas por todos los procesos con MPI-IO
+  int instantaneasColectivas = 0;
+  escritorInstantaneas escritor;
+  // pasos entre puntos de reinicio (0 sin puntos) y si se sigue desde uno
+  int intervaloReinicio = 0, reiniciar = 0, pasoInicial = 0;
+  char baseReinicio[1100];
+  escritorReinicio puntoReinicio;
+  // archivo de escenarios del modo conjunto, NULL para una sola simulación
+  char *archivoConjunto = NULL;
+  // reporte de la medición de los pasos y si se leen contadores
+  char *archivoMedicion = NULL;
+  int contadoresMedicion = 0;
+  // historial del paso adaptativo
+  historialPasos historial = {0};
+  // pasos entre revisiones del balance de las franjas, 0 sin balance
+  int intervaloBalance = 0;
+  // pasos máximos de los bloques temporales, 0 paso a paso
+  int pasosBloque = 0;
+  bloquesTemporales bloques = {0};
+  static struct option opcionesLargas[] = {
+      {"checkpoint", required_argument, NULL, 'g'},
+      {"ensemble", required_argument, NULL, 'l'},
+      {"profile", required_argument, NULL, 'i'},
+      {"perf-counters", no_argument, NULL, 'j'},
+      {"restart", no_argument, NULL, 'R'},
+      {"sim-time", required_argument, NULL, 'T'},
+      {"min-dt", required_argument, NULL, 'D'},
+      {"max-dt", required_argument, NULL, 'M'},
+      {"rebalance", required_argument, NULL, 'b'},
+      {"mpi-io", no_argument, NULL, 'o'},
+      {"out-of-core", required_argument, NULL, 'x'},
+      {"temporal-blocking", required_argument, NULL, 'u'},
+      {NULL, 0, NULL, 0}};
+
+  while ((option = getopt_long(argc, argv,
+                               "t:v:w:s:a:r:c:p:e:n:h:k:m:df:zg:Rl:i:jT:D:M:"
+                               "b:ox:u:",
+                               opcionesLargas, NULL)) != -1) {
     switch (option) {
     case 't':
       // Temperatura de erupción
@@ -846,11 +425,153 @@ int main(int argc, char *argv[]) {
       // Numero de pasos de tiempo
       c0.timeSteps = atol(optarg);
       break;
+    case 'h':
+      // Número de hilos por proceso
+#ifdef _OPENMP
+      omp_set_num_threads(atol(optarg));
+#else
+      if (rank == 0) {
+        printf("\nAVISO: compilado sin OpenMP (make OPENMP=1), se ignora -h");
+      }
+#endif
+      break;
+    case 'k':
+      // Núcleos de cálculo: auto, escalar, avx2, avx512, avx2-rapido o
+      // avx512-rapido (las rápidas no dan resultados idénticos)
+      nombreNucleos = optarg;
+      break;
+    case 'm':
+      // Marcos de la cola de instantáneas, 0 para escribirlas sin hilo aparte
+      marcosInstantaneas = atol(optarg);
+      break;
+    case 'd':
+      // Descartar instantáneas si la cola está llena, en lugar de esperar
+      descartarInstantaneas = 1;
+      break;
+    case 'f':
+      // Formato de las instantáneas: gnuplot, binario, binario32, png, o una
+      // sola animación apng o y4m
+      if (strcmp(optarg, "binario") == 0) {
+        formatoInstantaneas = formato_binario;
+      } else if (strcmp(optarg, "binario32") == 0) {
+        formatoInstantaneas = formato_binario32;
+      } else if (strcmp(optarg, "png") == 0) {
+        formatoInstantaneas = formato_png;
+      } else if (strcmp(optarg, "apng") == 0) {
+        formatoInstantaneas = formato_apng;
+      } else if (strcmp(optarg, "y4m") == 0) {
+        formatoInstantaneas = formato_y4m;
+      } else if (strcmp(optarg, "gnuplot") == 0) {
+        formatoInstantaneas = formato_gnuplot;
+      } else if (rank == 0) {
+        printf("\nAVISO: formato %s desconocido, se usa gnuplot", optarg);
+      }
+      break;
+    case 'z':
+      // Instantáneas binarias solo con las celdas que cambiaron
+      instantaneasDispersas = 1;
+      break;
+    case 'g':
+      // Guardar un punto de reinicio cada tantos pasos (--checkpoint)
+      intervaloReinicio = atol(optarg);
+      break;
+    case 'R':
+      // Seguir desde el último punto de reinicio de la etiqueta (--restart)
+      reiniciar = 1;
+      break;
+    case 'l':
+      // Simular los escenarios de este archivo sobre el terreno (--ensemble)
+      archivoConjunto = optarg;
+      break;
+    case 'i':
+      // Medir cada fase de cada paso y escribir el reporte (--profile)
+      archivoMedicion = optarg;
+      break;
+    case 'j':
+      // Leer también los contadores del procesador (--perf-counters)
+      contadoresMedicion = 1;
+      break;
+    case 'T':
+      // Segundos por simular con paso adaptativo (--sim-time); -n queda
+      // como el máximo de pasos
+      c0.targetTime = atof(optarg);
+      break;
+    case 'D':
+      // dt mínimo del paso adaptativo (--min-dt)
+      c0.minDeltat = atof(optarg);
+      break;
+    case 'M':
+      // dt máximo del paso adaptativo (--max-dt)
+      c0.maxDeltat = atof(optarg);
+      break;
+    case 'b':
+      // Revisar el balance de las franjas cada tantos pasos (--rebalance)
+      intervaloBalance = atol(optarg);
+      break;
+    case 'o':
+      // Instantáneas binarias escritas por todos los procesos en un solo
+      // archivo con MPI-IO (--mpi-io); no se usan -f, -z, -m ni -d
+      instantaneasColectivas = 1;
+      break;
+    case 'x':
+      // Guardar las mallas en archivos en este directorio, para mapas más
+      // grandes que la memoria (--out-of-core, ver malla.c)
+      if (!mallasEnArchivos(optarg) && rank == 0) {
+        printf("\nAVISO: no se puede escribir en %s, las mallas van en "
+               "memoria",
+               optarg);
+      }
+      break;
+    case 'u':
+      // Avanzar hasta tantos pasos por bloque de celdas mientras está en la
+      // caché (--temporal-blocking, ver bloques.c)
+      pasosBloque = atol(optarg);
+      break;
+    }
+  }
+  if (c0.targetTime > 0 && archivoConjunto != NULL) {
+    if (rank == 0) {
+      printf("\nAVISO: los escenarios usan dt fijo, se ignora -T");
     }
+    c0.targetTime = 0;
+  }
+  if (pasosBloque > 1 && (size > 1 || c0.targetTime > 0)) {
+    if (rank == 0) {
+      printf("\nAVISO: los bloques temporales necesitan un proceso y dt "
+             "fijo, se ignora -u");
+    }
+    pasosBloque = 0;
+  }
+  if (c0.targetTime > 0) {
+    if (c0.minDeltat <= 0) {
+      c0.minDeltat = min_time_delta;
+    }
+    if (c0.maxDeltat <= 0) {
+      c0.maxDeltat = max_time_delta;
+    }
+    if (c0.maxDeltat < c0.minDeltat) {
+      c0.maxDeltat = c0.minDeltat;
+    }
+    // sin -n, a lo sumo los pasos que se darían con el dt mínimo
+    if (c0.timeSteps <= 0) {
+      c0.timeSteps = (int)ceil(c0.targetTime / c0.minDeltat);
+    }
+  }
+  // antes de la primera región paralela, para abrir los contadores en los
+  // hilos de cálculo
+  if (archivoMedicion != NULL &&
+      !iniciarMedicion(c0.timeSteps, contadoresMedicion) && rank == 0) {
+    printf("\nAVISO: no hay memoria para la medición, se desactiva.");
   }
 
-  // dt esta de momento hardcoded, lo cambiaré más adelante
-  c0.deltat = time_delta;
+  if (!seleccionarNucleos(nombreNucleos) && rank == 0) {
+    printf("\nAVISO: núcleos %s desconocidos, se usan los %s", nombreNucleos,
+           nucleos.nombre);
+  }
+
+  // dt inicial; con -T lo ajusta ajustarDeltat después de cada paso
+  c0.deltat = (c0.targetTime > 0) ? c0.minDeltat : time_delta;
+  c0.elapsedTime = 0;
   // prueba de los parámetros ingresados
   // printf("\n\nparametros leidos filas=%d columnas=%d ancho=%lf velocidad=%lf
   // temperatura=%lf crateres=%d \n", c0.maxRows, c0.maxColumns, c0.anchoCelda,
@@ -859,46 +580,296 @@ int main(int argc, char *argv[]) {
   // tambien se pueden crear los punteros que representan las variantes
   // agrandadas y reducidas de la matriz
   // falta: liberar la memoria en cada paso.
-  testPoint = (mapCell *)malloc(c0.maxRows * c0.maxColumns * sizeof(mapCell));
-  resultPoint = (mapCell *)malloc((c0.maxRows + 2) * (c0.maxColumns + 2) *
-                                  sizeof(mapCell));
-  resultCalc = (mapCell *)malloc((c0.maxRows + 2) * (c0.maxColumns + 2) *
-                                 sizeof(mapCell));
-  resultPoint2 =
-      (mapCell *)malloc(c0.maxRows * c0.maxColumns * sizeof(mapCell));
-
-  // Leer el mapa de alturas
-  if (readTerrainFile(a_path, c0.maxRows, c0.maxColumns, testPoint)) {
-    // Crear puntero a todos los cráteres y leer archivo de posición de estos.
-    crateres = (point2D *)malloc(puntosCrater * sizeof(point2D));
-    if (readCratersPositionFile(s_path, puntosCrater, crateres)) {
-      placeCraters(testPoint, crateres, c0.maxRows, c0.maxColumns,
-                   puntosCrater);
-      preFuncion(c0.maxRows, c0.maxColumns, testPoint, resultPoint);
-
-      for (i = 0; i < c0.timeSteps; i++) {
-        printf("\n\nPaso de Tiempo %d: \n\n", i);
-        FuncionPrincipal(c0.maxRows + 2, c0.maxColumns + 2, resultPoint,
-                         resultCalc);
-        flag = obtenerPath(path);
+  // Solo el proceso 0 lee los archivos y arma la matriz agrandada completa,
+  // los demás procesos solo guardan su franja de filas.
+  int leido = 0;
+  franjaLocal franja;
+  // Un terreno binario trae sus dimensiones y el ancho de las celdas, que se
+  // usan si no se dieron con -r, -c y -w.  Todos los procesos leen el
+  // encabezado, así todos tienen las mismas dimensiones.
+  encabezadoTerreno terreno;
+  int terrenoBinario = leerEncabezadoTerreno(a_path, &terreno);
+  if (terrenoBinario) {
+    if (c0.maxRows == 0 && c0.maxColumns == 0) {
+      c0.maxRows = terreno.filas;
+      c0.maxColumns = terreno.columnas;
+    }
+    if (c0.cellWidth == 0) {
+      c0.cellWidth = terreno.anchoCelda;
+    }
+  }
+  if (archivoConjunto != NULL) {
+    // cada escenario trae su temperatura, velocidad y cráteres
+    simularConjunto(archivoConjunto, a_path, terrenoBinario, etiqueta);
+    MPI_Finalize();
+    return 0;
+  }
+  if (rank == 0) {
+    crearMalla(&resultPoint, c0.maxRows + 2, c0.maxColumns + 2);
+
+    // Leer el mapa de alturas, ya en la matriz agrandada
+    if (terrenoBinario
+            ? leerTerrenoBinario(a_path, c0.maxRows, c0.maxColumns,
+                                 &resultPoint)
+            : readTerrainFile(a_path, c0.maxRows, c0.maxColumns,
+                              &resultPoint)) {
+      // Crear puntero a todos los cráteres y leer archivo de posición de
+      // estos.
+      crateres = (point2D *)malloc(puntosCrater * sizeof(point2D));
+      if (readCratersPositionFile(s_path, puntosCrater, crateres)) {
+        placeCraters(&resultPoint, crateres, c0.maxRows, c0.maxColumns,
+                     puntosCrater);
+        leido = 1;
+      }
+      free(crateres);
+    }
+  }
+  MPI_Bcast(&leido, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+  if (leido) {
+    if (rank == 0) {
+      printf("\nUsando núcleos de cálculo %s.\n", nucleos.nombre);
+#ifdef _OPENMP
+      printf("Usando %d hilos por proceso.\n", omp_get_max_threads());
+#endif
+    }
+    if (crearFranja(&franja, c0.maxRows, c0.maxColumns, rank, size)) {
+      repartirFranjas(&resultPoint, &franja);
+      if (!crearActividad(&franja) && rank == 0) {
+        printf("\nNo hay memoria para el mapa de actividad, se calcula toda "
+               "la franja.\n");
+      }
+      if (rank == 0 && !instantaneasColectivas &&
+          !iniciarEscritor(&escritor, &resultPoint, marcosInstantaneas,
+                           descartarInstantaneas, formatoInstantaneas,
+                           instantaneasDispersas)) {
+        printf("\nNo hay memoria para %d marcos de instantáneas, se escribe "
+               "sin cola.\n",
+               marcosInstantaneas);
+        iniciarEscritor(&escritor, &resultPoint, 0, 0, formatoInstantaneas,
+                        0);
+      }
+      if (rank == 0 && (formatoInstantaneas == formato_binario ||
+                        formatoInstantaneas == formato_binario32 ||
+                        instantaneasColectivas) &&
+          !obtenerPath(path)) {
+        // las instantáneas binarias no traen la altitud, se guarda una vez
         strcat(path, "/");
         strcat(path, etiqueta);
-        strcat(path, "_");
-        // poner el path
-        if (!(flag)) {
-          if (i % 5 == 0) {
-            prepararVisualizacionGNUPlot_2(i, path, c0.maxRows + 2,
-                                           c0.maxColumns + 2, resultCalc, 3,
-                                           c0.cellWidth, 0, 0);
+        strcat(path, "_terreno.bin");
+        if (!escribirTerrenoBinario(path, &resultPoint, c0.cellWidth,
+                                    sizeof(double))) {
+          printf("***\nError al intentar escribir el archivo %s.\n***\n",
+                 path);
+        }
+      }
+
+      // puntos de reinicio etiqueta_reinicio_<rank>_<ranura>.scr en el
+      // directorio actual
+      snprintf(baseReinicio, sizeof(baseReinicio), "%s_reinicio", etiqueta);
+      if (reiniciar) {
+        pasoInicial = leerReinicio(&franja, baseReinicio);
+        if (rank == 0) {
+          if (pasoInicial < 0) {
+            printf("\nERROR: no hay un punto de reinicio completo de %s.\n",
+                   etiqueta);
+          } else {
+            printf("\nSiguiendo desde el paso %d.\n", pasoInicial);
           }
+        }
+      }
+      // la altitud ya no cambia, las distancias a las vecinas se calculan
+      // una sola vez
+      calcularDistancias(&franja.celdas);
+      if (intervaloReinicio > 0 &&
+          !iniciarReinicio(&puntoReinicio, &franja, baseReinicio)) {
+        printf("\nProceso %d: no hay memoria para los puntos de reinicio.\n",
+               rank);
+        intervaloReinicio = 0;
+      }
+      if (c0.targetTime > 0 && !iniciarHistorial(&historial, c0.timeSteps) &&
+          rank == 0) {
+        printf("\nNo hay memoria para el historial de dt, no se guarda.\n");
+      }
+      if (pasosBloque > 1 && !crearBloques(&bloques, &franja, pasosBloque)) {
+        printf("\nNo hay memoria para los bloques temporales, se avanza "
+               "paso a paso.\n");
+        pasosBloque = 0;
+      }
+
+      for (i = pasoInicial; pasoInicial >= 0 && i < c0.timeSteps &&
+                            !(c0.targetTime > 0 && tiempoCumplido());
+           i++) {
+        double t;
+        // un bloque termina en el paso de la siguiente instantánea o punto
+        // de reinicio, o en el último
+        int pasos = 1, p;
+        if (pasosBloque > 1 && i % 5 != 0) {
+          pasos = 5 - i % 5 + 1;
+          if (intervaloReinicio > 0 &&
+              intervaloReinicio - i % intervaloReinicio < pasos) {
+            pasos = intervaloReinicio - i % intervaloReinicio;
+          }
+          if (c0.timeSteps - i < pasos) {
+            pasos = c0.timeSteps - i;
+          }
+          if (bloques.pasos < pasos) {
+            pasos = bloques.pasos;
+          }
+        }
+        if (rank == 0 && c0.targetTime > 0) {
+          printf("\n\nPaso de Tiempo %d (t = %.3lf s, dt = %.3lf s): \n\n", i,
+                 c0.elapsedTime, c0.deltat);
+        } else if (rank == 0 && pasos > 1) {
+          printf("\n\nPasos de Tiempo %d a %d: \n\n", i, i + pasos - 1);
+        } else if (rank == 0) {
+          printf("\n\nPaso de Tiempo %d: \n\n", i);
+        }
+        empezarPaso(i, &franja);
+        if (pasos > 1) {
+          // el registro del bloque cuenta las celdas de todos sus pasos
+          medicion.actual.celdas *= pasos;
+          avanzarBloque(&bloques, &franja, pasos);
         } else {
-          printf("Problemas con el path\n");
+          FuncionPrincipal(&franja);
         }
-        memcpy(resultPoint, resultCalc,
-               (c0.maxRows + 2) * (c0.maxColumns + 2) * sizeof(mapCell));
+        if (c0.targetTime > 0) {
+          ajustarDeltat(&historial, &franja, i);
+        } else {
+          for (p = 0; p < pasos; p++) {
+            c0.elapsedTime += c0.deltat;
+          }
+        }
+        // i queda en el último paso del bloque
+        i += pasos - 1;
+        if (i % 5 == 0 && instantaneasColectivas) {
+          // cada proceso escribe su franja en etiqueta_<paso>.scf
+          t = marcaFase();
+          snprintf(path, sizeof(path), "%s_%d.scf", etiqueta, i);
+          escribirInstantaneaColectiva(path, &franja, i);
+          sumarFase(fase_instantaneas, t);
+        } else if (i % 5 == 0) {
+          // para visualizar se reúnen las franjas en un marco del escritor
+          // del proceso 0; si la cola está llena y se descarta, ningún
+          // proceso participa
+          marcoInstantanea *marco = NULL;
+          int reunir = 1;
+          t = marcaFase();
+          if (rank == 0) {
+            marco = pedirMarco(&escritor);
+            reunir = (marco != NULL);
+          }
+          MPI_Bcast(&reunir, 1, MPI_INT, 0, MPI_COMM_WORLD);
+          sumarFase(fase_instantaneas, t);
+          if (reunir) {
+            mapGrid vista = resultPoint;
+            if (rank == 0) {
+              vista.thickness = marco->thickness;
+              vista.temperature = marco->temperature;
+            }
+            t = marcaFase();
+            reunirFranjas(&franja, &vista);
+            sumarFase(fase_reunir, t);
+          }
+          t = marcaFase();
+          if (rank == 0 && reunir) {
+            flag = obtenerPath(path);
+            strcat(path, "/");
+            strcat(path, etiqueta);
+            strcat(path, "_");
+            // poner el path
+            if (!(flag)) {
+              entregarMarco(&escritor, marco, i, path);
+            } else {
+              printf("Problemas con el path\n");
+            }
+          }
+          sumarFase(fase_instantaneas, t);
+        }
+        t = marcaFase();
+        if (intervaloReinicio > 0 && (i + 1) % intervaloReinicio == 0 &&
+            !guardarReinicio(&puntoReinicio, &franja, i + 1)) {
+          printf("\nProceso %d: error al escribir el punto de reinicio.\n",
+                 rank);
+        }
+        sumarFase(fase_reinicio, t);
+        t = marcaFase();
+        if (intervaloBalance > 0 && (i + 1) % intervaloBalance == 0) {
+          double desbalance = balancearFranjas(&franja);
+          if (desbalance > 0 && rank == 0) {
+            printf("\nFranjas balanceadas: el proceso más lento tardaba %.2lf "
+                   "veces el promedio.\n",
+                   desbalance);
+          }
+          if (desbalance > 0 && intervaloReinicio > 0 &&
+              !ajustarReinicio(&puntoReinicio, &franja)) {
+            printf("\nProceso %d: error en los puntos de reinicio, ya no se "
+                   "guardan.\n",
+                   rank);
+            intervaloReinicio = 0;
+          }
+        }
+        sumarFase(fase_balance, t);
+        terminarPaso();
+      }
+      if (intervaloReinicio > 0 && !terminarReinicio(&puntoReinicio)) {
+        printf("\nProceso %d: error al escribir el punto de reinicio.\n",
+               rank);
+      }
+      if (rank == 0 && c0.targetTime > 0 && pasoInicial >= 0) {
+        printf("\nSe simularon %.3lf s de %.3lf s en %d pasos.\n",
+               c0.elapsedTime, c0.targetTime, i - pasoInicial);
+        if (!tiempoCumplido()) {
+          printf("AVISO: se llegó al máximo de %d pasos (-n).\n",
+                 c0.timeSteps);
+        }
+        if (historial.enMinimo > 0) {
+          printf("AVISO: en %d pasos el flujo pedía un dt menor que %g s "
+                 "(-D) y se usó %g s.\n",
+                 historial.enMinimo, c0.minDeltat, c0.minDeltat);
+        }
+        if (historial.bajoMinimo > 0) {
+          printf("AVISO: en %d pasos la radiación bajó el dt de %g s "
+                 "(-D).\n",
+                 historial.bajoMinimo, c0.minDeltat);
+        }
+        snprintf(path, sizeof(path), "%s_pasos.csv", etiqueta);
+        if (historial.capacidad > 0 &&
+            !escribirHistorial(&historial, path, pasoInicial > 0)) {
+          printf("***\nError al intentar escribir el archivo %s.\n***\n",
+                 path);
+        }
+      }
+      liberarHistorial(&historial);
+      liberarBloques(&bloques);
+      if (rank == 0 && !instantaneasColectivas) {
+        int descartadas = terminarEscritor(&escritor);
+        if (descartadas > 0) {
+          printf("\nSe descartaron %d instantáneas con la cola llena.\n",
+                 descartadas);
+        }
+      }
+      // el estado final va a etiqueta_final.scf, en el directorio actual
+      if (pasoInicial >= 0) {
+        snprintf(path, sizeof(path), "%s_final.scf", etiqueta);
+        postFuncion(&franja, path, i - 1);
       }
-      postFuncion(c0.maxRows + 2, c0.maxColumns + 2, resultCalc, resultPoint2,rank,size);
+    } else if (rank == 0) {
+      printf("\nERROR: %d procesos son demasiados para %d filas, cada "
+             "proceso necesita al menos %d filas.\n",
+             size, c0.maxRows, filas_halo);
+    }
+    liberarFranja(&franja);
+  }
+  if (rank == 0) {
+    liberarMalla(&resultPoint);
+  }
+  if (medicion.activa) {
+    if (leido && !escribirMedicion(archivoMedicion) && rank == 0) {
+      printf("***\nError al intentar escribir el archivo %s.\n***\n",
+             archivoMedicion);
     }
+    terminarMedicion();
   }
 
   // fin codigo de prueba;
@@ -1,3 +1,7 @@
+#include <mpi.h>
+#include <pthread.h>
+#include <stdio.h>
+
 // estas son las constantes físicas necesarias para los cálculos.
 // algunas se redefinen por parámetros de entrada del programa.
 #define density 2500.0
@@ -6,20 +10,63 @@
 #define emisivity 0.9
 #define SBConst 0.0000000568
 #define time_delta 1
+// dt mínimo y máximo por defecto del paso adaptativo (-T), en segundos
+#define min_time_delta time_delta
+#define max_time_delta 60
+
+// Tipo de los campos de las celdas.  Con make PRECISION=simple se guardan en
+// float: la malla ocupa casi la mitad y cada paso trae de memoria la mitad
+// de bytes.  Los núcleos siguen calculando en double a partir de los campos
+// y el calor recibido inboundQ, que acumula los aportes de las 8 vecinas,
+// se guarda siempre en double.  Comparada con double, después de 300 pasos
+// en terrenos sintéticos de 512 x 512 (build/terrenoSintetico, 4 cráteres)
+// la lava cubre las mismas celdas salvo entre 0.1% y 1.3% en el frente y el
+// volumen total difiere en menos de 2e-8.
+#ifdef PRECISION_SIMPLE
+typedef float real;
+#define mpi_real MPI_FLOAT
+#else
+typedef double real;
+#define mpi_real MPI_DOUBLE
+#endif
 
-// Esta es la estructura de cada mapCell
+// Esta es la estructura de la malla del mapa.  Se guarda como estructura de
+// arreglos: cada campo de las celdas va en su propio arreglo contiguo y
+// alineado a la línea de caché, así cada ciclo de FuncionPrincipal solo trae
+// de memoria los campos que usa.  La celda (i, j) es el índice
+// i * columnas + j de cada arreglo.
 typedef struct {
-  double thickness;
-  double temperature;
-  double altitude;
-  int isVent;
-  double yield;
-  double viscosity;
-  short exits;
-  double inboundV;
-  double outboundV;
-  double inboundQ;
-} mapCell;
+  int filas;
+  int columnas;
+  real *altitude;
+  real *thickness;
+  real *temperature;
+  real *yield;
+  real *viscosity;
+  real *inboundV;
+  real *outboundV;
+  double *inboundQ;
+  short *exits;
+  char *isVent;
+  // distancias a las vecinas por la pendiente, 4 planos de filas x columnas
+  // (ver calcularDistancias en nucleos.c); solo las franjas la tienen
+  real *distancia;
+} mapGrid;
+
+// Distancia sqrt((altitud de k - altitud de la vecina)^2 + ancho^2) entre la
+// celda k y su vecina (l, m).  Es simétrica, así que solo se guardan las
+// direcciones hacia adelante (0, 1), (1, -1), (1, 0) y (1, 1); las otras
+// cuatro se leen desde la vecina.  Las celdas consecutivas de una fila
+// tienen sus distancias consecutivas.
+static inline const real *distanciaVecina(const mapGrid *A, int k, int l,
+                                          int m) {
+  size_t plano = (size_t)A->filas * A->columnas;
+  if (l > 0 || (l == 0 && m > 0)) {
+    return A->distancia + (l == 0 ? 0 : m + 2) * plano + k;
+  }
+  return A->distancia + (l == 0 ? 0 : 2 - m) * plano + k + l * A->columnas +
+         m;
+}
 
 // estructura de los puntos de los cráteres
 typedef struct {
@@ -35,26 +82,404 @@ typedef struct {
   double eruptionRate;
   double eruptionTemperature;
   double deltat;
+  // paso de tiempo adaptativo (ver paso.c): con targetTime > 0 se simulan
+  // targetTime segundos con pasos de entre minDeltat y maxDeltat segundos
+  double minDeltat;
+  double maxDeltat;
+  double targetTime;
+  double elapsedTime; // segundos simulados hasta el paso actual
   int timeSteps;
 } initialConditions;
 
+// condiciones iniciales de la simulación, definidas en scalaf.c
+extern initialConditions c0;
+
+// filas fantasma que se intercambian con cada vecino en cada paso de tiempo.
+// Con dos filas cada proceso puede calcular las salidas de su primera fila
+// fantasma, que son necesarias para los flujos de su primera fila propia.
+#define filas_halo 2
+
+// lado, en celdas, de los bloques (tiles) del mapa de actividad.  Debe ser
+// al menos 2: el halo del paso anterior tiene un paso de retraso y la lava
+// avanza a lo sumo una celda por paso.
+#define lado_tile 32
+
+// estructura de la franja de filas de la matriz agrandada que le corresponde
+// a cada proceso.  Las filas se numeran en la matriz agrandada (la fila 0 y
+// la fila maxRows+1 son los bordes).  La franja local guarda las filas
+// [filaInicio - filas_halo, filaFin + filas_halo).
+typedef struct {
+  int rank;
+  int size;
+  int filas;        // filas interiores de la matriz completa (maxRows)
+  int filaInicio;   // primera fila propia, en la matriz agrandada
+  int filaFin;      // una después de la última fila propia
+  int filasPropias; // filaFin - filaInicio
+  int columnas;     // columnas de la matriz agrandada (maxColumns + 2)
+  int arriba;       // proceso vecino con las filas anteriores o MPI_PROC_NULL
+  int abajo;        // proceso vecino con las filas siguientes o MPI_PROC_NULL
+  mapGrid celdas;   // (filasPropias + 2 * filas_halo) x columnas celdas
+  // filas de cada proceso para repartir y reunir (conteos) y la primera
+  // de cada uno (desplazamientos); cambian solo con moverFranjas
+  int *conteos;
+  int *desplazamientos;
+  MPI_Datatype filaReal;   // una fila completa de un campo real
+  MPI_Datatype filaChar;   // una fila completa de un campo char
+  // mapa de actividad por tiles de lado_tile x lado_tile celdas locales
+  int filasTiles;
+  int columnasTiles;
+  unsigned char *vivas;   // tiles con alguna celda con lava, cráter o caliente
+  unsigned char *activas; // tiles vivas y sus vecinas, las únicas que se
+                          // calculan en el siguiente paso
+  // volúmenes cedidos de tres filas (8 direcciones x columnas cada una) por
+  // cada hilo, para calcular salidas y flujos en una sola pasada
+  double *cedidos;
+  int hilos;
+  // solo con el paso adaptativo: mayor cambio relativo de grosor de una
+  // celda con lava en el último paso, y dt con el que la radiación se
+  // llevaría todo el calor de alguna celda
+  double cambioGrosor;
+  double deltatRadiacion;
+  // segundos de cálculo de FuncionPrincipal, sin la espera del halo, desde
+  // la última revisión del balance
+  double segundosCalculo;
+} franjaLocal;
+
 // prototipos de las funciones principales
-void FuncionPrincipal(int filas, int columnas, mapCell *A, mapCell *C);
+void FuncionPrincipal(franjaLocal *F);
+void consolidarTramo(mapGrid *A, int i, int j0, int j1, double *cambio,
+                     double *radiacion);
 int leerArchivoTexto_Matriz(char *path, int filas, int columnas,
-                            mapCell *matriz);
-void preFuncion(int, int, const mapCell *, mapCell *);
-void postFuncion(int, int, const mapCell *A, mapCell *C,int rank, int size);
+                            mapGrid *matriz);
+int postFuncion(const franjaLocal *F, const char *path, int paso);
 int leerArchivoPuntos(char *, int, point2D *);
-int colocarCrateres(mapCell *, const point2D *, int, int, int);
+int colocarCrateres(mapGrid *, const point2D *, int, int, int);
+
+// funciones del mapa de actividad
+int crearActividad(franjaLocal *F);
+void liberarActividad(franjaLocal *F);
+void actualizarActividad(franjaLocal *F, int completo);
+int siguienteTramo(const franjaLocal *F, int i, int *j0, int *j1);
+int siguienteTramoVecino(const franjaLocal *F, int i, int *j0, int *j1);
+
+// encabezado de los archivos de terreno binarios (ver terreno.c)
+#define bytes_encabezado_terreno 64
+typedef struct {
+  int filas;
+  int columnas;
+  double anchoCelda;
+  int bytesValor; // 4 para float, 8 para double
+} encabezadoTerreno;
+
+// funciones del terreno, leen en la matriz agrandada (filas + 2) x
+// (columnas + 2) con los bordes ya puestos
+int readTerrainFile(char *path, int filas, int columnas, mapGrid *A);
+int leerEncabezadoTerreno(const char *path, encabezadoTerreno *E);
+int leerTerrenoBinario(char *path, int filas, int columnas, mapGrid *A);
+int escribirTerrenoBinario(const char *path, const mapGrid *A,
+                           double anchoCelda, int bytesValor);
+int escribirEncabezadoTerreno(FILE *archivo, int filas, int columnas,
+                              double anchoCelda, int bytesValor);
+
+// funciones de la malla
+int crearMalla(mapGrid *M, int filas, int columnas);
+int crearDistancias(mapGrid *M);
+void liberarMalla(mapGrid *M);
+void celdaBorde(mapGrid *M, int k);
+int camposMalla(const mapGrid *M, void **campos, size_t *bytes);
+int mallasEnArchivos(const char *directorio);
+void *reservarArreglo(size_t bytes);
+void liberarArreglo(void *p);
+void anticiparCeldas(const mapGrid *M, int i0, int i1, int j0, int j1);
+
+// funciones de la descomposición del dominio en franjas de filas
+int crearFranja(franjaLocal *F, int filas, int columnas, int rank, int size);
+void liberarFranja(franjaLocal *F);
+void repartirFranjas(const mapGrid *A, franjaLocal *F);
+void reunirFranjas(const franjaLocal *F, mapGrid *A);
+void iniciarIntercambioHalo(franjaLocal *F, MPI_Request *solicitudes);
+void terminarIntercambioHalo(MPI_Request *solicitudes);
+int moverFranjas(franjaLocal *F, const int *inicios, int migrar);
+
+// balance de carga entre las franjas (ver balance.c)
+double balancearFranjas(franjaLocal *F);
+
+// bloques temporales: varios pasos por bloque de celdas (ver bloques.c)
+typedef struct {
+  int pasos;          // pasos máximos de un bloque
+  int filasBloques;   // bloques de la franja
+  int columnasBloques;
+  // grosor y temperatura nuevos de las celdas propias de los bloques, del
+  // tamaño de la franja
+  real *thickness;
+  real *temperature;
+  unsigned char *calcular; // bloques con algún tile activo
+  int hilos;
+  mapGrid *celdas;    // un bloque con sus celdas de más por hilo
+  double *cedidos;    // anillo de tres filas de volúmenes cedidos por hilo
+} bloquesTemporales;
+
+int crearBloques(bloquesTemporales *B, const franjaLocal *F, int pasos);
+void liberarBloques(bloquesTemporales *B);
+void avanzarBloque(bloquesTemporales *B, franjaLocal *F, int pasos);
+
+// escritor de puntos de reinicio de la franja local (ver reinicio.c)
+typedef struct {
+  char base[1024];   // nombre base de los archivos
+  int rank;
+  int size;
+  int filaInicio;
+  int filaFin;
+  int filasTiles;    // 0 si la franja no tiene mapa de actividad
+  int columnasTiles;
+  mapGrid copia;     // copia de la franja que escribe el hilo
+  unsigned char *vivas;
+  unsigned char *activas;
+  initialConditions c0;
+  int paso;          // paso en el que sigue la simulación
+  int ranura;        // ranura 0 o 1 de la última escritura
+  int ok;            // resultado de la última escritura
+  int enCurso;       // hay un hilo escribiendo
+  pthread_t hilo;
+} escritorReinicio;
+
+int iniciarReinicio(escritorReinicio *R, const franjaLocal *F,
+                    const char *base);
+int guardarReinicio(escritorReinicio *R, const franjaLocal *F, int paso);
+int ajustarReinicio(escritorReinicio *R, const franjaLocal *F);
+int terminarReinicio(escritorReinicio *R);
+int leerReinicio(franjaLocal *F, const char *base);
+
+// conjunto de escenarios sobre un mismo terreno (ver conjunto.c)
+int simularConjunto(const char *escenarios, char *a_path, int terrenoBinario,
+                    const char *etiqueta);
+
+// mapa de peligro acumulado sobre los miembros de un conjunto, en el mapa
+// sin agrandar (ver peligro.c)
+typedef struct {
+  int filas;
+  int columnas;
+  int miembros;              // miembros terminados en este proceso
+  int *inundadas;            // miembros en los que la celda tuvo lava
+  double *grosorMaximo;
+  double *temperaturaMaxima;
+  int *primeraLlegada;       // primer paso con lava en algún miembro
+  int *llegada;              // primer paso con lava del miembro actual, o -1
+} mapaPeligro;
+
+int crearMapaPeligro(mapaPeligro *P, int filas, int columnas);
+void liberarMapaPeligro(mapaPeligro *P);
+void iniciarMiembro(mapaPeligro *P);
+void acumularPaso(mapaPeligro *P, const franjaLocal *F, int paso);
+void terminarMiembro(mapaPeligro *P);
+int escribirMapaPeligro(mapaPeligro *P, const char *path, int pasos);
+
+// paso de tiempo adaptativo (ver paso.c)
+typedef struct {
+  int numPasos;
+  int capacidad;
+  int enMinimo;   // pasos con minDeltat aunque el flujo pedía menos
+  int bajoMinimo; // pasos con menos de minDeltat por la radiación
+  int *paso;
+  double *tiempo; // segundos simulados al final del paso
+  double *deltat;
+  double *flujo;     // dt del flujo, infinito si ningún grosor cambió
+  double *radiacion; // dt de la radiación, infinito si no hay lava
+} historialPasos;
+
+int iniciarHistorial(historialPasos *H, int pasos);
+void liberarHistorial(historialPasos *H);
+void ajustarDeltat(historialPasos *H, const franjaLocal *F, int paso);
+int tiempoCumplido(void);
+int escribirHistorial(const historialPasos *H, const char *path, int agregar);
+
+// medición del paso de tiempo (ver medicion.c)
+enum {
+  fase_reologia,
+  fase_salidas_flujos, // salidas y flujos, en una sola pasada
+  fase_consolidacion,
+  fase_halo,           // espera del intercambio de filas fantasma
+  fase_actividad,
+  fase_reunir,         // reunir las franjas para una instantánea
+  fase_instantaneas,   // pedir y entregar marcos al escritor
+  fase_reinicio,
+  fase_balance,        // revisar el balance y mover las franjas
+  num_fases
+};
+#define num_contadores 3 // ciclos, instrucciones y fallos de caché LLC
+
+// registro de un paso de un proceso
+typedef struct {
+  int paso;
+  double fase[num_fases]; // segundos en cada fase
+  double total;           // segundos del paso completo
+  long long celdas;       // celdas propias calculadas
+  long long contador[num_contadores]; // -1 si no hay contadores
+} registroPaso;
+
+typedef struct {
+  int activa;
+  registroPaso actual;
+  registroPaso *registros;
+  int numRegistros;
+  int capacidad;
+  double inicioPaso;
+  long long inicioContadores[num_contadores];
+  int hilos;
+  int *contadores; // descriptores de perf_event_open, num_contadores por hilo
+} medicionPasos;
+
+extern medicionPasos medicion;
+
+int iniciarMedicion(int pasos, int contadores);
+double marcaFase(void);
+void sumarFase(int fase, double inicio);
+void empezarPaso(int paso, const franjaLocal *F);
+void terminarPaso(void);
+int escribirMedicion(const char *path);
+void terminarMedicion(void);
+
+// núcleos de cálculo por fila de FuncionPrincipal.  Hay versión escalar,
+// AVX2 y AVX-512; seleccionarNucleos escoge al iniciar según el procesador.
+typedef struct {
+  const char *nombre;
+  // viscosidad y yield de n celdas consecutivas a partir de la temperatura
+  void (*reologia)(const real *temperature, real *viscosity,
+                   real *yieldStress, int n);
+  // salidas de las celdas [j0, j1) de la fila i (en exits si escribir es 1)
+  // y volumen que cada una cede a sus 8 vecinas, en cedido[0..7][j]
+  void (*salidas)(mapGrid *A, int i, int j0, int j1, double *const *cedido,
+                  int escribir);
+  // inboundV, inboundQ y outboundV de las celdas [j0, j1) de la fila i, con
+  // los volúmenes cedidos de las filas i - 1, i e i + 1 en cedido[0..23]
+  void (*flujos)(mapGrid *A, int i, int j0, int j1, double *const *cedido);
+} nucleosCalculo;
+
+extern nucleosCalculo nucleos;
+int seleccionarNucleos(const char *nombre);
+void calcularDistancias(mapGrid *A);
+void reologiaEscalar(const real *, real *, real *, int);
+void salidasEscalar(mapGrid *, int, int, int, double *const *, int);
+void flujosEscalar(mapGrid *, int, int, int, double *const *);
+void reologiaAVX2(const real *, real *, real *, int);
+void salidasAVX2(mapGrid *, int, int, int, double *const *, int);
+void flujosAVX2(mapGrid *, int, int, int, double *const *);
+void reologiaAVX512(const real *, real *, real *, int);
+void salidasAVX512(mapGrid *, int, int, int, double *const *, int);
+void flujosAVX512(mapGrid *, int, int, int, double *const *);
+
+// formatos de las instantáneas
+#define formato_gnuplot 0   // texto para gnuplot y la imagen
+#define formato_binario 1   // binario en double (ver instantaneas_bin.c)
+#define formato_binario32 2 // binario en float
+#define formato_png 3       // imagen PNG generada sin gnuplot (imagen.c)
+#define formato_apng 4      // una sola animación PNG con todos los pasos
+#define formato_y4m 5       // una sola animación YUV4MPEG2 sin comprimir
+
+// rasterizador de las imágenes PNG, con el fondo del terreno ya sombreado
+typedef struct {
+  int ancho;
+  int alto;
+  int *celdaFila;          // fila de la matriz agrandada de cada pixel
+  int *celdaColumna;       // columna de la matriz agrandada de cada pixel
+  unsigned char *fondo;    // terreno sombreado, RGB
+  double temperaturaMaxima; // temperatura con el color más claro
+} rasterizador;
+
+int crearRasterizador(rasterizador *R, const mapGrid *terreno,
+                      double anchoCelda, double temperaturaMaxima);
+void liberarRasterizador(rasterizador *R);
+int escribirImagenPNG(const rasterizador *R, const mapGrid *A,
+                      const char *path);
+
+// animación que se escribe cuadro por cuadro
+typedef struct {
+  FILE *archivo;
+  int formato;          // formato_apng o formato_y4m
+  int cuadros;          // cuadros escritos, -1 si hubo un error
+  int secuencia;        // siguiente número de secuencia de fcTL y fdAT
+  long posicionControl; // posición del bloque acTL, para corregirlo al final
+} animacion;
+
+int abrirAnimacion(animacion *V, const rasterizador *R, const char *path,
+                   int formato);
+int agregarCuadro(animacion *V, const rasterizador *R, const mapGrid *A);
+int cerrarAnimacion(animacion *V);
+
+// grosor y temperatura de las celdas interiores de la última instantánea
+// binaria escrita o leída
+typedef struct {
+  int filas;
+  int columnas;
+  int secuencia; // -1 si todavía no tiene una instantánea
+  double *thickness;
+  double *temperature;
+} estadoInstantanea;
+
+#define bytes_encabezado_instantanea 64
+
+int crearEstadoInstantanea(estadoInstantanea *S, int filas, int columnas);
+void liberarEstadoInstantanea(estadoInstantanea *S);
+int escribirInstantaneaBinaria(const char *path, const mapGrid *A,
+                               int secuencia, int bytesValor,
+                               estadoInstantanea *previo);
+int leerInstantaneaBinaria(const char *path, estadoInstantanea *S);
+void encabezadoInstantanea(unsigned char *enca, int filas, int columnas,
+                           int secuencia, int bytesValor, int dispersa,
+                           int anterior, long long celdas);
+
+// instantáneas binarias completas escritas por todos los procesos con
+// MPI-IO, sin reunir las franjas (ver instantaneas_mpi.c)
+int escribirInstantaneaColectiva(const char *path, const franjaLocal *F,
+                                 int secuencia);
+
+// marco de la cola de instantáneas: grosor y temperatura de la matriz
+// agrandada en el paso secuencia
+typedef struct {
+  real *thickness;
+  real *temperature;
+  int secuencia;
+  char path[1024]; // nombre base de los archivos
+} marcoInstantanea;
+
+// escritor de instantáneas en segundo plano (ver instantaneas.c).  Los
+// marcos ocupados son los numMarcos siguientes a primero, en orden circular.
+typedef struct {
+  const mapGrid *terreno; // matriz agrandada, de ahí sale la altitud
+  marcoInstantanea *marcos;
+  int numMarcos;
+  int primero;     // siguiente marco que escribe el hilo
+  int ocupados;    // marcos entregados y aún no escritos
+  int descartar;   // 1: con la cola llena se descartan instantáneas
+  int descartadas;
+  int formato;     // uno de los formato_*
+  int dispersas;   // 1: las binarias guardan solo las celdas que cambian
+  estadoInstantanea previo; // última binaria escrita, para las dispersas
+  rasterizador imagen;      // para formato_png y las animaciones
+  animacion video;          // para formato_apng y formato_y4m
+  int enHilo;      // 0: se escribe en el hilo de la simulación
+  int terminar;
+  pthread_t hilo;
+  pthread_mutex_t cerrojo;
+  pthread_cond_t hayMarco;
+  pthread_cond_t hayLibre;
+} escritorInstantaneas;
+
+int iniciarEscritor(escritorInstantaneas *E, const mapGrid *terreno,
+                    int numMarcos, int descartar, int formato, int dispersas);
+marcoInstantanea *pedirMarco(escritorInstantaneas *E);
+void entregarMarco(escritorInstantaneas *E, marcoInstantanea *m,
+                   int secuencia, const char *path);
+int terminarEscritor(escritorInstantaneas *E);
 
 // funciones de utilidades, prototipos
 int limpiarPath(char[], char[]);
 int obtenerPath(char[]);
-void imprimirMatrizPantalla(int, int, const mapCell *, int);
-void imprimirMatrizPantalla_2(int, int, const mapCell *, int);
-int prepararVisualizacionGNUPlot(int, char *, int, int, mapCell *, int, double,
-                                 double, double);
-int prepararVisualizacionGNUPlot_2(int, char *, int, int, mapCell *, int,
+void imprimirMatrizPantalla(int, int, const mapGrid *, int);
+void imprimirMatrizPantalla_2(int, int, const mapGrid *, int);
+int prepararVisualizacionGNUPlot(int, char *, int, int, const mapGrid *, int,
+                                 double, double, double);
+int prepararVisualizacionGNUPlot_2(int, char *, int, int, const mapGrid *, int,
                                    double, double, double);
 
 // funciones de cálculo de valores físicos
@@ -62,5 +487,4 @@ double visc(double);
 double yield(double);
 
 // funciones de prueba o incompletas, prototipos
-int generarAnimacionGNUPlot(char[], int);
 void testAnimacion(void);
\ No newline at end of file
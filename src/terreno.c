@@ -0,0 +1,427 @@
+/*
+Lectura del mapa de alturas del terreno, en texto (CSV) o en el formato
+binario de scalaf.  Las dos lecturas escriben directamente en la matriz
+agrandada, con las filas y columnas extras de los bordes ya puestas.
+
+El formato binario es un encabezado de 64 bytes seguido de las altitudes
+fila por fila, en float o double según el encabezado:
+
+  bytes  0..7   "SCALAFT1"
+  bytes  8..11  filas (int32)
+  bytes 12..15  columnas (int32)
+  bytes 16..23  ancho de las celdas (double)
+  bytes 24..27  bytes por altitud, 4 (float) o 8 (double) (int32)
+  bytes 28..63  ceros
+
+Los números van en el orden de bytes de la máquina.  Los archivos
+binarios se crean a partir de los CSV con build/csvABinario.
+*/
+
+#include "scalaf.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static const char magiaTerreno[8] = {'S', 'C', 'A', 'L', 'A', 'F', 'T', '1'};
+
+// Valores iniciales de la celda k del terreno sin lava.
+static void celdaTerreno(mapGrid *map, size_t k, double altitud) {
+  map->altitude[k] = altitud;
+  map->thickness[k] = 0;
+  map->isVent[k] = 0;
+  map->temperature[k] = 273.0;
+  map->yield[k] = 0.0;
+  map->viscosity[k] = 0.0;
+  map->exits[k] = 0;
+  map->inboundV[k] = 0;
+  map->outboundV[k] = 0;
+  map->inboundQ[k] = 0;
+}
+
+// Pone los bordes de la matriz agrandada A: las filas 0 y filas+1 completas
+// y las columnas extras de cada fila.
+static void bordesAgrandada(mapGrid *A) {
+  int i, j, C = A->columnas;
+  for (j = 0; j < C; j++) {
+    celdaBorde(A, j);
+    celdaBorde(A, (A->filas - 1) * C + j);
+  }
+  for (i = 1; i < A->filas - 1; i++) {
+    celdaBorde(A, i * C);
+    celdaBorde(A, i * C + C - 1);
+  }
+}
+
+// Proyecta en memoria el archivo completo, solo para lectura.  Devuelve
+// NULL si no se puede abrir o está vacío.
+static const char *proyectarArchivo(const char *path, size_t *bytes) {
+  struct stat info;
+  void *mapa;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+  *bytes = info.st_size;
+  mapa = mmap(NULL, *bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapa == MAP_FAILED) {
+    return NULL;
+  }
+  madvise(mapa, *bytes, MADV_SEQUENTIAL);
+  return (const char *)mapa;
+}
+
+// potencias de 10 que se representan exactas en double
+static const double potencias10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Convierte el número de [p, fin) a double.  Los números con a lo sumo 15
+// dígitos y exponente decimal de a lo sumo 22 (todas las altitudes de un
+// mapa normal) se calculan con una sola multiplicación o división de
+// valores exactos, que da el mismo double correctamente redondeado que
+// strtod.  Los demás casos usan strtod.
+static double convertirNumero(const char *p, const char *fin) {
+  const char *q = p;
+  unsigned long long mantisa = 0;
+  int digitos = 0, decimales = 0, exponente = 0, negativo = 0;
+  char copia[128];
+  size_t largo;
+  if (q < fin && (*q == '-' || *q == '+')) {
+    negativo = (*q == '-');
+    q++;
+  }
+  while (q < fin && *q >= '0' && *q <= '9') {
+    if (mantisa || *q != '0') {
+      mantisa = mantisa * 10 + (*q - '0');
+      digitos++;
+    }
+    q++;
+    if (digitos > 15) {
+      goto lento;
+    }
+  }
+  if (q < fin && *q == '.') {
+    q++;
+    while (q < fin && *q >= '0' && *q <= '9') {
+      if (mantisa || *q != '0') {
+        mantisa = mantisa * 10 + (*q - '0');
+        digitos++;
+      }
+      decimales++;
+      q++;
+      if (digitos > 15) {
+        goto lento;
+      }
+    }
+  }
+  if (q < fin && (*q == 'e' || *q == 'E')) {
+    int signo = 1, valor = 0;
+    q++;
+    if (q < fin && (*q == '-' || *q == '+')) {
+      signo = (*q == '-') ? -1 : 1;
+      q++;
+    }
+    while (q < fin && *q >= '0' && *q <= '9' && valor < 1000) {
+      valor = valor * 10 + (*q - '0');
+      q++;
+    }
+    exponente = signo * valor;
+  }
+  if (q == fin) {
+    double v = (double)mantisa;
+    exponente -= decimales;
+    if (exponente >= 0 && exponente <= 22) {
+      v *= potencias10[exponente];
+      return negativo ? -v : v;
+    }
+    if (exponente < 0 && exponente >= -22) {
+      v /= potencias10[-exponente];
+      return negativo ? -v : v;
+    }
+  }
+lento:
+  // texto que no es un número simple, se deja a strtod igual que atof
+  largo = fin - p;
+  if (largo >= sizeof(copia)) {
+    largo = sizeof(copia) - 1;
+  }
+  memcpy(copia, p, largo);
+  copia[largo] = '\0';
+  return strtod(copia, NULL);
+}
+
+// espacios que pueden rodear los valores, incluido el fin de línea
+static inline int esEspacio(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Revisa si la línea [p, fin) tiene algo además de espacios.
+static int lineaConDatos(const char *p, const char *fin) {
+  for (; p < fin; p++) {
+    if (!esEspacio(*p)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Lee los valores de la línea [p, fin) en la fila i de la matriz agrandada
+// A, que tiene columnas + 2 columnas.  Igual que con strtok se ignoran los
+// campos vacíos y los valores que sobran.  Devuelve el número de valores
+// leídos.
+static int leerLinea(const char *p, const char *fin, int i, int columnas,
+                     mapGrid *A) {
+  int j = 0;
+  size_t base = (size_t)(i + 1) * A->columnas + 1;
+  while (p < fin && j < columnas) {
+    const char *q, *r;
+    while (p < fin && (*p == ',' || esEspacio(*p))) {
+      p++;
+    }
+    if (p == fin) {
+      break;
+    }
+    q = memchr(p, ',', fin - p);
+    if (q == NULL) {
+      q = fin;
+    }
+    r = q;
+    while (r > p && esEspacio(r[-1])) {
+      r--;
+    }
+    if (r > p) {
+      celdaTerreno(A, base + j, convertirNumero(p, r));
+      j++;
+    }
+    p = q;
+  }
+  return j;
+}
+
+// Inicio de la línea que sigue a la posición o, o fin.
+static const char *siguienteLinea(const char *o, const char *fin) {
+  const char *q = memchr(o, '\n', fin - o);
+  return q ? q + 1 : fin;
+}
+
+// Lee un mapa de alturas CSV de filas x columnas en la matriz agrandada A,
+// que ya debe estar creada con (filas + 2) x (columnas + 2) celdas.  Cada
+// línea con datos es una fila del mapa, sin límite de largo.  El archivo se
+// proyecta en memoria y se parte en trozos en finales de línea; primero se
+// cuentan las filas de cada trozo para saber dónde empieza cada uno, y
+// luego los trozos se leen en paralelo.  Devuelve 0 si el archivo no existe
+// o tiene menos filas o columnas de las pedidas.
+int readTerrainFile(char *path, int filas, int columnas, mapGrid *A) {
+  size_t bytes;
+  const char *texto = proyectarArchivo(path, &bytes);
+  const char *fin;
+  const char **inicios;
+  int *primeraFila;
+  int t, trozos, filasLeidas, filaIncompleta = filas;
+  if (texto == NULL) {
+    printf("\nERROR: Mapa de alturas no encontrado!");
+    return 0;
+  }
+  printf("\nLeyendo mapa de alturas del terreno...");
+  fin = texto + bytes;
+#ifdef _OPENMP
+  trozos = 4 * omp_get_max_threads();
+#else
+  trozos = 1;
+#endif
+  if ((size_t)trozos > bytes / 4096 + 1) {
+    trozos = bytes / 4096 + 1;
+  }
+  inicios = (const char **)malloc((trozos + 1) * sizeof(const char *));
+  primeraFila = (int *)malloc((trozos + 1) * sizeof(int));
+  inicios[0] = texto;
+  for (t = 1; t < trozos; t++) {
+    const char *o = texto + bytes / trozos * t;
+    inicios[t] = (o > inicios[t - 1]) ? siguienteLinea(o, fin) : inicios[t - 1];
+  }
+  inicios[trozos] = fin;
+
+  // filas de cada trozo
+#pragma omp parallel for schedule(dynamic, 1)
+  for (t = 0; t < trozos; t++) {
+    const char *p = inicios[t];
+    int n = 0;
+    while (p < inicios[t + 1]) {
+      const char *q = siguienteLinea(p, inicios[t + 1]);
+      n += lineaConDatos(p, q);
+      p = q;
+    }
+    primeraFila[t + 1] = n;
+  }
+  primeraFila[0] = 0;
+  for (t = 1; t <= trozos; t++) {
+    primeraFila[t] += primeraFila[t - 1];
+  }
+  filasLeidas = (primeraFila[trozos] < filas) ? primeraFila[trozos] : filas;
+
+#pragma omp parallel for schedule(dynamic, 1) reduction(min : filaIncompleta)
+  for (t = 0; t < trozos; t++) {
+    const char *p = inicios[t];
+    int i = primeraFila[t];
+    while (p < inicios[t + 1] && i < filas) {
+      const char *q = siguienteLinea(p, inicios[t + 1]);
+      if (lineaConDatos(p, q)) {
+        if (leerLinea(p, q, i, columnas, A) < columnas && i < filaIncompleta) {
+          filaIncompleta = i;
+        }
+        i++;
+      }
+      p = q;
+    }
+  }
+  munmap((void *)texto, bytes);
+  free(inicios);
+  free(primeraFila);
+
+  if (filaIncompleta < filas) {
+    printf("\nERROR: la fila %d del mapa de alturas tiene menos de %d "
+           "columnas.",
+           filaIncompleta + 1, columnas);
+    return 0;
+  }
+  if (filasLeidas < filas) {
+    printf("\nERROR: el mapa de alturas solo tiene %d de %d filas.",
+           filasLeidas, filas);
+    return 0;
+  }
+  bordesAgrandada(A);
+  printf("\n\t- Terreno inicializado correctamente.");
+  return 1;
+}
+
+// Lee el encabezado de un archivo de terreno binario.  Devuelve 0 si el
+// archivo no existe o no es binario (por ejemplo, un CSV).
+int leerEncabezadoTerreno(const char *path, encabezadoTerreno *E) {
+  unsigned char enca[bytes_encabezado_terreno];
+  FILE *archivo = fopen(path, "rb");
+  int leidos;
+  if (archivo == NULL) {
+    return 0;
+  }
+  leidos = fread(enca, 1, sizeof(enca), archivo);
+  fclose(archivo);
+  if (leidos != sizeof(enca) ||
+      memcmp(enca, magiaTerreno, sizeof(magiaTerreno)) != 0) {
+    return 0;
+  }
+  memcpy(&E->filas, enca + 8, sizeof(int));
+  memcpy(&E->columnas, enca + 12, sizeof(int));
+  memcpy(&E->anchoCelda, enca + 16, sizeof(double));
+  memcpy(&E->bytesValor, enca + 24, sizeof(int));
+  return E->filas > 0 && E->columnas > 0 &&
+         (E->bytesValor == sizeof(float) || E->bytesValor == sizeof(double));
+}
+
+// Lee las altitudes de un terreno binario en la matriz agrandada A, igual
+// que readTerrainFile.  El archivo se proyecta en memoria con mmap y se
+// recorre una sola vez, sin búferes intermedios.
+int leerTerrenoBinario(char *path, int filas, int columnas, mapGrid *A) {
+  encabezadoTerreno E;
+  size_t bytes;
+  const char *mapa;
+  int i;
+  if (!leerEncabezadoTerreno(path, &E)) {
+    printf("\nERROR: %s no es un terreno binario válido!", path);
+    return 0;
+  }
+  if (E.filas != filas || E.columnas != columnas) {
+    printf("\nERROR: el terreno binario es de %d x %d, no de %d x %d.",
+           E.filas, E.columnas, filas, columnas);
+    return 0;
+  }
+  mapa = proyectarArchivo(path, &bytes);
+  if (mapa == NULL || bytes < bytes_encabezado_terreno +
+                                  (size_t)filas * columnas * E.bytesValor) {
+    printf("\nERROR: el terreno binario %s está incompleto!", path);
+    if (mapa != NULL) {
+      munmap((void *)mapa, bytes);
+    }
+    return 0;
+  }
+  printf("\nLeyendo mapa de alturas binario del terreno...");
+#pragma omp parallel for schedule(static)
+  for (i = 0; i < filas; i++) {
+    const char *fila =
+        mapa + bytes_encabezado_terreno + (size_t)i * columnas * E.bytesValor;
+    size_t base = (size_t)(i + 1) * A->columnas + 1;
+    int j;
+    for (j = 0; j < columnas; j++) {
+      if (E.bytesValor == sizeof(float)) {
+        celdaTerreno(A, base + j, ((const float *)fila)[j]);
+      } else {
+        celdaTerreno(A, base + j, ((const double *)fila)[j]);
+      }
+    }
+  }
+  munmap((void *)mapa, bytes);
+  bordesAgrandada(A);
+  printf("\n\t- Terreno inicializado correctamente.");
+  return 1;
+}
+
+// Escribe el encabezado de un terreno binario de filas x columnas.  Después
+// van las altitudes fila por fila con bytesValor bytes cada una.  Devuelve 0
+// si hay un error.
+int escribirEncabezadoTerreno(FILE *archivo, int filas, int columnas,
+                              double anchoCelda, int bytesValor) {
+  unsigned char enca[bytes_encabezado_terreno] = {0};
+  memcpy(enca, magiaTerreno, sizeof(magiaTerreno));
+  memcpy(enca + 8, &filas, sizeof(int));
+  memcpy(enca + 12, &columnas, sizeof(int));
+  memcpy(enca + 16, &anchoCelda, sizeof(double));
+  memcpy(enca + 24, &bytesValor, sizeof(int));
+  return fwrite(enca, 1, sizeof(enca), archivo) == sizeof(enca);
+}
+
+// Escribe las altitudes de las celdas interiores de la matriz agrandada A
+// en un terreno binario, en float si bytesValor es 4 o en double si es 8.
+// Devuelve 0 si hay un error.
+int escribirTerrenoBinario(const char *path, const mapGrid *A,
+                           double anchoCelda, int bytesValor) {
+  int filas = A->filas - 2, columnas = A->columnas - 2;
+  int i, j, ok;
+  FILE *archivo;
+  if (bytesValor != sizeof(float) && bytesValor != sizeof(double)) {
+    return 0;
+  }
+  archivo = fopen(path, "wb");
+  if (archivo == NULL) {
+    return 0;
+  }
+  ok = escribirEncabezadoTerreno(archivo, filas, columnas, anchoCelda,
+                                 bytesValor);
+  for (i = 1; i <= filas && ok; i++) {
+    const real *fila = A->altitude + (size_t)i * A->columnas + 1;
+    if (bytesValor == sizeof(real)) {
+      ok = fwrite(fila, sizeof(real), columnas, archivo) == columnas;
+    } else if (bytesValor == sizeof(double)) {
+      for (j = 0; j < columnas && ok; j++) {
+        double a = fila[j];
+        ok = fwrite(&a, sizeof(double), 1, archivo) == 1;
+      }
+    } else {
+      for (j = 0; j < columnas && ok; j++) {
+        float a = (float)fila[j];
+        ok = fwrite(&a, sizeof(float), 1, archivo) == 1;
+      }
+    }
+  }
+  return (fclose(archivo) == 0) && ok;
+}
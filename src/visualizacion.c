@@ -0,0 +1,262 @@
+/*
+Salida para visualizar la simulación con gnuplot: archivos de datos y de
+encabezado de cada instantánea, y utilidades de rutas.
+*/
+
+#include "scalaf.h"
+#include "string.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// nota, falta implementar las cifras significativas
+int prepararVisualizacionGNUPlot(int secuencia, char *path, int filas,
+                                 int columnas, const mapGrid *matriz,
+                                 int cifrasSignif, double w, double x0,
+                                 double y0) {
+  // Esta función genera los dos archivos necesarios para producir una imagen
+  // en GNU plot.  Los archivos son:
+  // 1. datafile.dat (o variantes) que contiene los datos de altitud,
+  // temperatura y grosor de la capa, teniendo en cuenta que altitud ya tiene en
+  // cuenta el de la capa, pero este se incluye para dar mas opciones
+  // 2. archivo de comandos, que incluye lo necesario para poder configurar
+  // el área de dibujo, las escalas, las leyendas, etc.
+  // Los parámetros son matriz, que es la matriz completa con los resultados
+  // nombreArchivo, que es el nombre base de los archivos de datos a producir
+  // y secuencia, en el caso en el que se produzcan varios archivos para
+  // generar una animación, nos dará el orden.  El resultado es un plot de gnu
+  // plot mas una imagen png exportada a partir de eso, que llevará como nombre
+  // nombreArchivo + secuencia.png
+  FILE *datosAltitud;
+  FILE *encabezado;
+  size_t sizep;
+  int i, j, flag;
+  double xcoord, ycoord, zcoord, temp;
+  sizep = strlen(path);
+  long int cont;
+  char newpath[500], tsec[20], pathenca[550], command[700], f_path[1024];
+  // printf("\nNumero de caracteres de la ruta del archivo %d\n",(int)sizep);
+  if (sizep != 0) {
+    strcpy(newpath, path);
+    sprintf(tsec, "%d", secuencia);
+    strcat(newpath, tsec);
+    printf("Escribiendo archivo: %s\n", newpath);
+    datosAltitud = fopen(newpath, "w");
+    if (datosAltitud != NULL) {
+      printf("Guardando en archivo...\n");
+      // Escribiendo los datos
+      cont = 0;
+      for (j = 0; j < columnas; ++j) { // aca debo cambiar esto, altitude +
+                                       // thickness da la altura, osea la z
+        for (i = 0; i < filas; ++i) {
+          xcoord = x0 + i * w;
+          ycoord = y0 + j * w;
+          zcoord = matriz->thickness[columnas * i + j] +
+                   matriz->altitude[columnas * i + j];
+          temp = matriz->temperature[columnas * i + j];
+          fprintf(datosAltitud, "%6.3lf %6.3lf %6.3lf %6.3lf\n", xcoord, ycoord,
+                  zcoord, temp);
+          cont += 1;
+        }
+        // para las isolineas
+        fprintf(datosAltitud, "\n");
+      }
+      printf("Se escribieron %ld elementos.\n\n", cont);
+      fclose(datosAltitud);
+    } else {
+      printf("***\nError al intentar escribir el archivo de datos.\n***\n\n");
+    }
+    strcpy(pathenca, newpath);
+    strcat(pathenca, "_enca");
+    printf("Guardando archivo de encabezado %s \n", pathenca);
+    encabezado = fopen(pathenca, "w");
+    if (encabezado != NULL) {
+      // escribiendo el encabezado, pero en GNUPLOT es diferente
+      // se muestran opciones para png y eps
+      // fprintf(encabezado,"set terminal png size 400,300 enhanced font
+      // \"Helvetica,20\"\n\n",newpath);
+      fprintf(encabezado, "set terminal png size 1366,720 enhanced\n\n",
+              newpath);
+      fprintf(encabezado, "set output '%s.png'\n", newpath);
+      // dejo estas líneas comentadas por si necesito configurar mejor
+      // la visualización.
+      // fprintf(encabezado,"set term postscript eps enhanced color\n");
+      // fprintf(encabezado,"set output '%s.eps'\n",newpath);
+      // fprintf(encabezado,"set autoscale y #set	autoscale	# scale
+      // axes automatically\n"); fprintf(encabezado,"unset label	# remove
+      // any previous labels\n"); fprintf(encabezado,"set encoding utf8\n\n");
+      // fprintf(encabezado,"set isosamples 100\n");
+      // fprintf(encabezado,"set samples 100\n\n");
+      // fprintf(encabezado,"unset key\n");
+      // fprintf(encabezado,"unset grid\n");
+      // fprintf(encabezado,"unset border\n");
+      // fprintf(encabezado,"unset tics\n");
+      fprintf(encabezado, "set xrange [0:20]\n");
+      fprintf(encabezado, "set yrange [0:20]\n");
+      fprintf(encabezado, "set zrange [0:20]\n\n");
+      fprintf(encabezado, "set colorbox\n");
+      // fprintf(encabezado,"unset surface\n");
+      fprintf(encabezado, "set pm3d\n");
+      fprintf(encabezado, "set title \"%d\"\n\n", secuencia);
+      fprintf(encabezado, "splot \"%s\" using 1:2:3:4 with pm3d\n", newpath);
+      fprintf(encabezado, "reset\n");
+      fclose(encabezado);
+    } else {
+      printf(
+          "\n***\nError al intentar escribir el archivo de ecabezado.\n***\n");
+    }
+    // se ejecuta el gnu plot para generar el archivo de imagen
+    limpiarPath(pathenca, f_path);
+    strcpy(command, "gnuplot ");
+    strcat(command, f_path);
+    printf("Ejecutando comando: %s\n", command);
+    flag = system(command);
+    printf("Mensaje del comando %d\n", flag);
+  }
+}
+
+// Esta es una copia de la funcion anterior que ignora los espacios extras
+// de la matriz aumentada
+int prepararVisualizacionGNUPlot_2(int secuencia, char *path, int filas,
+                                   int columnas, const mapGrid *matriz,
+                                   int cifrasSignif, double w, double x0,
+                                   double y0) {
+  // Esta función genera los dos archivos necesarios para producir una imagen
+  // en GNU plot.  Los archivos son:
+  // 1. datafile.dat (o variantes) que contiene los datos de altitud,
+  // temperatura y grosor de la capa, teniendo en cuenta que altitud ya tiene en
+  // cuenta el de la capa, pero este se incluye para dar mas opciones
+  // 2. archivo de comandos, que incluye lo necesario para poder configurar
+  // el área de dibujo, las escalas, las leyendas, etc.
+  // Los parámetros son matriz, que es la matriz completa con los resultados
+  // nombreArchivo, que es el nombre base de los archivos de datos a producir
+  // y secuencia, en el caso en el que se produzcan varios archivos para
+  // generar una animación, nos dará el orden.  El resultado es un plot de gnu
+  // plot mas una imagen png exportada a partir de eso, que llevará como nombre
+  // nombreArchivo + secuencia.png
+  FILE *datosAltitud;
+  FILE *encabezado;
+  size_t sizep;
+  int i, j, flag;
+  double xcoord, ycoord, zcoord, temp;
+  sizep = strlen(path);
+  long int cont;
+  char newpath[500], tsec[20], pathenca[550], command[700], f_path[1024];
+  // printf("\nNumero de caracteres de la ruta del archivo %d\n",(int)sizep);
+  if (sizep != 0) {
+    strcpy(newpath, path);
+    sprintf(tsec, "%d", secuencia);
+    strcat(newpath, tsec);
+    printf("Escribiendo archivo: %s\n", newpath);
+    datosAltitud = fopen(newpath, "w");
+    if (datosAltitud != NULL) {
+      printf("Guardando en archivo...\n");
+      // Escribiendo los datos
+      cont = 0;
+      for (j = 1; j < columnas - 1; ++j) { // aca debo cambiar esto, altitude +
+                                           // thickness da la altura, osea la z
+        for (i = 1; i < filas - 1; ++i) {
+          xcoord = x0 + (i - 1) * w;
+          ycoord = y0 + (j - 1) * w;
+          zcoord = matriz->thickness[columnas * i + j] +
+                   matriz->altitude[columnas * i + j];
+          temp = matriz->temperature[columnas * i + j];
+          fprintf(datosAltitud, "%6.3lf %6.3lf %6.8lf %6.8lf\n", xcoord, ycoord,
+                  zcoord, temp);
+          cont += 1;
+        }
+        // para las isolineas
+        fprintf(datosAltitud, "\n");
+      }
+      printf("Se escribieron %ld elementos.\n\n", cont);
+      fclose(datosAltitud);
+    } else {
+      printf("***\nError al intentar escribir el archivo de datos.\n***\n\n");
+    }
+    strcpy(pathenca, newpath);
+    strcat(pathenca, "_enca");
+    printf("Guardando archivo de encabezado %s \n", pathenca);
+    encabezado = fopen(pathenca, "w");
+    if (encabezado != NULL) {
+      // escribiendo el encabezado, pero en GNUPLOT es diferente
+      // se muestran opciones para png y eps
+      // fprintf(encabezado,"set terminal png size 400,300 enhanced font
+      // \"Helvetica,20\"\n\n",newpath);
+      fprintf(encabezado, "set terminal png size 1366,720 enhanced\n\n",
+              newpath);
+      fprintf(encabezado, "set output '%s.png'\n", newpath);
+      // dejo estas líneas comentadas por si necesito configurar mejor
+      // la visualización.
+      // fprintf(encabezado,"set term postscript eps enhanced color\n");
+      // fprintf(encabezado,"set output '%s.eps'\n",newpath);
+      // fprintf(encabezado,"set autoscale y #set	autoscale	# scale
+      // axes automatically\n"); fprintf(encabezado,"unset label	# remove
+      // any previous labels\n"); fprintf(encabezado,"set encoding utf8\n\n");
+      // fprintf(encabezado,"set isosamples 100\n");
+      // fprintf(encabezado,"set samples 100\n\n");
+      // fprintf(encabezado,"unset key\n");
+      fprintf(encabezado, "set grid\n");
+      // fprintf(encabezado,"unset border\n");
+      // fprintf(encabezado,"unset tics\n");
+      fprintf(encabezado, "set xrange [0:%d]\n", filas - 2);
+      fprintf(encabezado, "set yrange [0:%d]\n", filas - 2);
+      fprintf(encabezado, "set zrange [0:3]\n\n");
+      fprintf(encabezado, "set colorbox\n");
+      // fprintf(encabezado,"unset surface\n");
+      fprintf(encabezado, "set pm3d\n");
+      fprintf(encabezado, "set title \"%d\"\n\n", secuencia);
+      fprintf(encabezado, "splot \"%s\" using 1:2:3:4 with pm3d\n", newpath);
+      fprintf(encabezado, "reset\n");
+      fclose(encabezado);
+    } else {
+      printf(
+          "\n***\nError al intentar escribir el archivo de ecabezado.\n***\n");
+    }
+    // se ejecuta el gnu plot para generar el archivo de imagen
+    limpiarPath(pathenca, f_path);
+    strcpy(command, "gnuplot ");
+    strcat(command, f_path);
+    printf("Ejecutando comando: %s\n", command);
+    flag = system(command);
+    printf("Mensaje del comando %d\n", flag);
+  }
+}
+
+/*
+ * Función para obtener el path actual, y de esta manera generar
+ * las imagenes en el directorio actual.
+ */
+int obtenerPath(char path[]) {
+  char cwd[1024];
+  if (getcwd(cwd, sizeof(cwd)) != NULL) {
+    fprintf(stdout, "Current working dir: %s\n", cwd);
+    strcpy(path, cwd);
+    return 0;
+  } else {
+    perror("getcwd() error");
+    return 1;
+  }
+}
+
+// función para colocar \ donde sean necesarios y de esta manera
+// poder usar paths y nombres de archivos con espacios.
+int limpiarPath(char path[], char spath[]) {
+  char r_path[1024], f_path[1024];
+  int i, j;
+  int lg = 0;
+  strcpy(r_path, path);
+  lg = strlen(r_path);
+  j = 0;
+  for (i = 0; i < lg; ++i) {
+    if (r_path[i] == ' ') {
+      f_path[j] = '\\';
+      f_path[j + 1] = ' ';
+      j += 2;
+    } else {
+      f_path[j] = r_path[i];
+      j += 1;
+    }
+  }
+  f_path[j] = '\0';
+  strcpy(spath, f_path);
+}